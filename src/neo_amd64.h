@@ -292,6 +292,30 @@ static void xop_ri(mcode_t **mxp, aluop_t opc, gpr_t reg, imm_t x, bool x64) {
     *mxp = p; /* Update pointer to current machine code buffer. */
 }
 
+#if NEO_OS_LINUX
+
+#include <unistd.h>
+
+/*
+** Linux perf symbol map for JIT code.
+** perf reads /tmp/perf-<pid>.map to symbolize anonymous executable memory, so every compiled region must be registered.
+** Each line has the format: <start-hex> <size-hex> <symbol>. The symbol is <class>.<method>, or just <method> for global methods.
+*/
+#define PERFMAP_PATH_FMT "/tmp/perf-%d.map"
+
+static NEO_COLDPROC bool perfmap_register(const mcode_t *p, size_t len, const char *cls, const char *method) {
+    neo_dassert(p != NULL && len && method != NULL, "Invalid arguments");
+    char path[64];
+    snprintf(path, sizeof(path), PERFMAP_PATH_FMT, (int)getpid());
+    FILE *f = fopen(path, "a");
+    if (neo_unlikely(!f)) { return false; }
+    fprintf(f, "%" PRIxPTR " %zx %s%s%s\n", (uintptr_t)p, len, cls ? cls : "", cls ? "." : "", method);
+    fclose(f); /* Flush line immediately, perf might read the map while we are still running. */
+    return true;
+}
+
+#endif
+
 #ifdef NEO_EXTENSION_DISASSEMBLER
 
 #include <Zydis/Zydis.h>
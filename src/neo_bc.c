@@ -276,3 +276,188 @@ void bc_emit_fpush(bytecode_t *self, neo_float_t x) {
         bc_emit(self, bci_comp_mod1_umm24(OPC_LDC, key));
     }
 }
+
+/*
+** Bytecode to C99 transpiler.
+** Bytecode is straight-line code, so the stack depth before each instruction is known at transpile time
+** and every stack access becomes a fixed slot sp[depth], which the C compiler can keep in registers.
+** Semantics are the same as vm_exec: Stack overflow is checked only when a new maximum depth is reached,
+** stack underflow is detected statically and becomes an unconditional exit and the result state is written identically.
+*/
+
+#define _(enumerator, _2, _3, _4) [enumerator] = #enumerator
+static const char *const syscall_enumerator[SYSCALL__LEN] = {syscalldef(_, NEO_SEP)};
+#undef _
+
+static NEO_COLDPROC void c99_exit(FILE *f, int indent, const char *vif, size_t ip, size_t depth) {
+    fprintf(f, "%*s{ vif = %s; ip = %zu; d = %zu; goto exit; }\n", indent, "", vif, ip, depth);
+}
+
+void bc_transpile_c99(const bytecode_t *self, FILE *f, const char *name) {
+    neo_dassert(self != NULL && f != NULL && name != NULL && self->p != NULL, "self, f, name and self->p must not be NULL.");
+    neo_assert(self->len && bci_unpackopc(self->p[0]) == OPC_NOP, "(Prologue-Code) First instruction must be NOP");
+    neo_assert(bci_unpackopc(self->p[self->len-1]) == OPC_HLT, "(epilogue) last instruction must be HLT");
+    neo_assert(*name && !(*name >= '0' && *name <= '9'), "Invalid C identifier: %s", name);
+    for (const char *c = name; *c; ++c) { /* Name is used as symbol prefix, so it must be a valid C identifier. */
+        bool ok = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_';
+        neo_assert(ok, "Invalid C identifier: %s", name);
+    }
+    uint32_t plen = self->pool.len;
+    fprintf(f, "/* Generated from NEO bytecode V.%" PRIu32 ", L: %zu, K: %" PRIu32 ". Do not edit. */\n", self->ver, self->len, plen);
+    fputs("/* Compile and link against the NEO runtime, e.g.: cc -std=gnu99 -O3 -c <file> -I <neo>/src */\n\n", f);
+    fputs("#include \"neo_vm.h\"\n\n", f);
+
+    /* Bytecode and metaspace are kept as static const arrays, so rstate.ip and the exec hooks see the same bytecode as vm_exec. */
+    fprintf(f, "static const bci_instr_t %s_code[%zu] = {", name, self->len);
+    for (size_t i = 0; i < self->len; ++i) {
+        fprintf(f, "%s0x%08" PRIx32 "%s", i % 8 ? "" : "\n    ", self->p[i], i+1 < self->len ? ", " : "\n");
+    }
+    fputs("};\n", f);
+    if (plen) {
+        fprintf(f, "static const record_t %s_pool[%" PRIu32 "] = {\n", name, plen);
+        for (uint32_t i = 0; i < plen; ++i) {
+            record_t v = self->pool.p[i];
+            fprintf(f, "    {.ru64 = UINT64_C(0x%016" PRIx64 ")}%s /* ", v.ru64, i+1 < plen ? "," : "");
+            switch ((rtag_t)self->pool.tags[i]) {
+                case RT_INT: fprintf(f, "int %" PRIi64, v.as_int); break;
+                case RT_FLOAT: fprintf(f, "float %f", v.as_float); break;
+                case RT_CHAR: fprintf(f, "char %" PRIu32, (uint32_t)v.as_char); break;
+                case RT_BOOL: fprintf(f, "bool %s", v.as_bool ? "true" : "false"); break;
+                case RT_REF: fputs("ref", f); break;
+                default: neo_panic("Invalid record tag: %" PRIu8, self->pool.tags[i]);
+            }
+            fputs(" */\n", f);
+        }
+        fprintf(f, "};\nstatic const uint8_t %s_tags[%" PRIu32 "] = {", name, plen);
+        for (uint32_t i = 0; i < plen; ++i) {
+            fprintf(f, "%" PRIu8 "%s", self->pool.tags[i], i+1 < plen ? ", " : "");
+        }
+        fputs("};\n", f);
+    }
+    fprintf(
+        f,
+        "static const bytecode_t %s_bcode = {\n"
+        "    .ver = %" PRIu32 ",\n"
+        "    .p = (bci_instr_t *)%s_code,\n"
+        "    .cap = %zu,\n"
+        "    .len = %zu,\n",
+        name, self->ver, name, self->len, self->len
+    );
+    if (plen) {
+        fprintf(f, "    .pool = {.p = (record_t *)%s_pool, .tags = (uint8_t *)%s_tags, .len = %" PRIu32 ", .cap = %" PRIu32 "}\n", name, name, plen, plen);
+    } else {
+        fputs("    .pool = {.p = NULL, .tags = NULL, .len = 0, .cap = 0}\n", f);
+    }
+    fputs("};\n\n", f);
+
+    fprintf(f, "extern NEO_HOTPROC bool %s(vm_isolate_t *self);\n", name);
+    fprintf(f, "NEO_HOTPROC bool %s(vm_isolate_t *self) {\n", name);
+    fputs("    neo_assert(self != NULL && self->stack.p != NULL && self->stack.len, \"self and stack must not be NULL and stack must not be empty\");\n", f);
+    fprintf(f, "    if (self->pre_exec_hook) {\n        (*self->pre_exec_hook)(self, &%s_bcode);\n    }\n", name);
+    fputs("    record_t *const restrict sp = self->stack.p; /* Stack base, sp[0] is padding. */\n", f);
+    fputs("    vm_interrupt_t vif = VMINT_OK; /* VM interrupt flag. */\n", f);
+    fputs("    size_t ip = 0, d = 0; /* Instruction index and stack depth at exit. */\n", f);
+    fputs("    sp->as_uint = STK_PADD_MAGIC;\n", f);
+
+    size_t depth = 0; /* Current stack depth. */
+    size_t maxdepth = 0; /* Maximum stack depth which is already checked for overflow. */
+    for (size_t i = 0; i < self->len; ++i) {
+        bci_instr_t instr = self->p[i];
+        opcode_t opc = bci_unpackopc(instr);
+        umm24_t sysc = opc == OPC_SYSCALL ? bci_mod1unpack_umm24(instr) : 0;
+        neo_assert(opc < OPC__LEN && sysc < SYSCALL__LEN, "Invalid instruction: 0x%08" PRIx32, instr);
+        size_t ops = opc == OPC_SYSCALL ? syscall_stack_ops[sysc] : opc_stack_ops[opc];
+        size_t rtvs = opc == OPC_SYSCALL ? syscall_stack_rtvs[sysc] : opc_stack_rtvs[opc];
+        fprintf(f, "    /* 0x%04zx ", i);
+        bci_dump_instr(instr, f, false);
+        fputs(" */\n", f);
+        if (neo_unlikely(depth < ops)) { /* Stack underflow, all following instructions are unreachable. */
+            c99_exit(f, 4, "VMINT_STK_UNDERFLOW", i, depth);
+            break;
+        }
+        size_t next = depth-ops+rtvs; /* Stack depth after instruction. */
+        if (next > maxdepth) { /* Same check as vm_exec: sp+delta > stack.p+stack.len-1. */
+            fprintf(f, "    if (neo_unlikely(self->stack.len < %zu))\n", next+1);
+            c99_exit(f, 8, "VMINT_STK_OVERFLOW", i, depth);
+            maxdepth = next;
+        }
+        size_t t = depth; /* Top of stack. */
+        size_t s = depth-(depth != 0); /* Second record, only valid for binary ops. */
+        switch (opc) {
+            case OPC_HLT: c99_exit(f, 4, "VMINT_OK", i, depth); break;
+            case OPC_NOP: break;
+            case OPC_SYSCALL:
+                fprintf(f, "    if (neo_unlikely(vm_syscall(self, %s, sp+%zu)))\n", syscall_enumerator[sysc], t);
+                c99_exit(f, 8, "VMINT_SYS_SYSCALL", i, depth);
+                break;
+            case OPC_IPUSH: fprintf(f, "    sp[%zu].as_int = %" PRIi32 ";\n", next, bci_mod1unpack_imm24(instr)); break;
+            case OPC_IPUSH0: fprintf(f, "    sp[%zu].as_int = 0;\n", next); break;
+            case OPC_IPUSH1: fprintf(f, "    sp[%zu].as_int = 1;\n", next); break;
+            case OPC_IPUSH2: fprintf(f, "    sp[%zu].as_int = 2;\n", next); break;
+            case OPC_IPUSHM1: fprintf(f, "    sp[%zu].as_int = -1;\n", next); break;
+            case OPC_FPUSH0: fprintf(f, "    sp[%zu].as_float = 0.0;\n", next); break;
+            case OPC_FPUSH1: fprintf(f, "    sp[%zu].as_float = 1.0;\n", next); break;
+            case OPC_FPUSH2: fprintf(f, "    sp[%zu].as_float = 2.0;\n", next); break;
+            case OPC_FPUSH05: fprintf(f, "    sp[%zu].as_float = 0.5;\n", next); break;
+            case OPC_FPUSHM1: fprintf(f, "    sp[%zu].as_float = -1.0;\n", next); break;
+            case OPC_POP: break;
+            case OPC_LDC: {
+                umm24_t k = bci_mod1unpack_umm24(instr);
+                neo_assert(k < plen, "Invalid constant pool slot index: %" PRIu32, k);
+                fprintf(f, "    sp[%zu] = %s_pool[%" PRIu32 "];\n", next, name, k);
+            } break;
+            case OPC_IADD:
+            case OPC_ISUB:
+            case OPC_IMUL: {
+                const char *op = opc == OPC_IADD ? "add" : opc == OPC_ISUB ? "sub" : "mul";
+                fprintf(f, "    if (neo_unlikely(__builtin_%s_overflow(sp[%zu].as_int, sp[%zu].as_int, &sp[%zu].as_int)))\n", op, s, t, s);
+                c99_exit(f, 8, "VMINT_ARI_OVERFLOW", i, depth);
+            } break;
+            case OPC_IPOW:
+                fprintf(f, "    if (neo_unlikely(vmop_ipow64(sp[%zu].as_int, sp[%zu].as_int, &sp[%zu].as_int)))\n", s, t, s);
+                c99_exit(f, 8, "VMINT_ARI_OVERFLOW", i, depth);
+                break;
+            case OPC_IADDO: fprintf(f, "    sp[%zu].as_uint += sp[%zu].as_uint;\n", s, t); break; /* Unsigned to wrap without UB. */
+            case OPC_ISUBO: fprintf(f, "    sp[%zu].as_uint -= sp[%zu].as_uint;\n", s, t); break;
+            case OPC_IMULO: fprintf(f, "    sp[%zu].as_uint *= sp[%zu].as_uint;\n", s, t); break;
+            case OPC_IPOWO: fprintf(f, "    sp[%zu].as_int = vmop_ipow64_no_ov(sp[%zu].as_int, sp[%zu].as_int);\n", s, s, t); break;
+            case OPC_IDIV:
+            case OPC_IMOD: { /* Same single compare fast path as z_op in vm_exec. */
+                bool div = opc == OPC_IDIV;
+                fprintf(f, "    if (neo_unlikely((neo_uint_t)sp[%zu].as_int+1 <= 1)) {\n", t);
+                fprintf(f, "        if (sp[%zu].as_int == 0)\n", t);
+                c99_exit(f, 12, "VMINT_ARI_ZERODIV", i, depth);
+                if (div) {
+                    fprintf(f, "        sp[%zu].as_int = sp[%zu].as_int == NEO_INT_MIN ? NEO_INT_MIN : -sp[%zu].as_int;\n", s, s, s);
+                } else {
+                    fprintf(f, "        sp[%zu].as_int = 0;\n", s);
+                }
+                fprintf(f, "    } else {\n        sp[%zu].as_int %s= sp[%zu].as_int;\n    }\n", s, div ? "/" : "%", t);
+            } break;
+            case OPC_IAND: fprintf(f, "    sp[%zu].as_int &= sp[%zu].as_int;\n", s, t); break;
+            case OPC_IOR: fprintf(f, "    sp[%zu].as_int |= sp[%zu].as_int;\n", s, t); break;
+            case OPC_IXOR: fprintf(f, "    sp[%zu].as_int ^= sp[%zu].as_int;\n", s, t); break;
+            case OPC_ISAL: fprintf(f, "    sp[%zu].as_uint <<= sp[%zu].as_uint & 63;\n", s, t); break;
+            case OPC_ISAR: fprintf(f, "    sp[%zu].as_int >>= sp[%zu].as_uint & 63;\n", s, t); break;
+            case OPC_ISLR: fprintf(f, "    sp[%zu].as_uint >>= sp[%zu].as_uint & 63;\n", s, t); break;
+            case OPC_IROL: fprintf(f, "    sp[%zu].as_uint = neo_rol64(sp[%zu].as_uint, sp[%zu].as_uint & 63);\n", s, s, t); break;
+            case OPC_IROR: fprintf(f, "    sp[%zu].as_uint = neo_ror64(sp[%zu].as_uint, sp[%zu].as_uint & 63);\n", s, s, t); break;
+            case OPC__LEN: neo_unreachable();
+        }
+        if (opc == OPC_HLT) { break; } /* Everything after the first HLT is unreachable. */
+        depth = next;
+    }
+
+    fputs("exit:\n", f);
+    fprintf(f, "    self->rstate.interrupt = vif;\n");
+    fprintf(f, "    self->rstate.ip = %s_code+ip;\n", name);
+    fputs("    self->rstate.sp = sp+d;\n", f);
+    fputs("    self->gc_context.stk_top = sp+d;\n", f);
+    fputs("    self->rstate.ip_delta = (ptrdiff_t)ip;\n", f);
+    fputs("    self->rstate.sp_delta = (ptrdiff_t)d;\n", f);
+    fputs("    ++self->rstate.invocs;\n", f);
+    fputs("    if (vif == VMINT_OK) { ++self->rstate.invocs_ok; }\n", f);
+    fputs("    else { ++self->rstate.invocs_err; }\n", f);
+    fprintf(f, "    if (self->post_exec_hook) {\n        (*self->post_exec_hook)(self, &%s_bcode, self->rstate.interrupt);\n    }\n", name);
+    fputs("    return vif == VMINT_OK;\n}\n", f);
+}
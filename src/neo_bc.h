@@ -208,6 +208,12 @@ extern NEO_EXPORT void bc_emit_fpush(bytecode_t *self, neo_float_t x);
 extern NEO_EXPORT const bci_instr_t *bc_finalize(bytecode_t *self);
 extern NEO_EXPORT NEO_COLDPROC void bc_disassemble(const bytecode_t *self, FILE *f, bool colored);
 extern NEO_EXPORT void bc_free(bytecode_t *self);
+/*
+** Transpile verified bytecode into a standalone C99 translation unit, which defines: bool <name>(vm_isolate_t *self).
+** The function behaves like vm_exec on the same bytecode, so AOT builds can compile it with the system C compiler.
+** Name must be a valid C identifier and is also used as prefix for the static bytecode and metaspace arrays.
+*/
+extern NEO_EXPORT NEO_COLDPROC void bc_transpile_c99(const bytecode_t *self, FILE *f, const char *name);
 extern NEO_NODISCARD bool bc_validate(const bytecode_t *self, const struct vm_isolate_t *isolate);
 
 #ifdef __cplusplus
@@ -14,6 +14,10 @@ NEO_THREAD_LOCAL void *volatile neo_tls_proxy = NULL;
 
 #   include <unistd.h>
 #   include <time.h>
+#   include <sys/mman.h>
+#   if NEO_OS_LINUX
+#       include <sys/syscall.h>
+#   endif
 
 #else
 #   error "unsupported platform"
@@ -46,9 +50,68 @@ void neo_osi_init(void) {
     osi_data.page_size = ps > 0 ? (uint32_t)ps : 0x1000;
 #else
 #   error "unsupported platform"
+#endif
+    osi_data.huge_page_size = 2u<<20;
+    osi_data.numa_nodes = 1;
+#if NEO_OS_LINUX
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    if (f) {
+        unsigned long hps = 0;
+        if (fscanf(f, "%lu", &hps) == 1 && hps && hps <= UINT32_MAX) { osi_data.huge_page_size = (uint32_t)hps; }
+        fclose(f);
+    }
+    char path[64];
+    for (uint32_t n = 1; n < 1024; ++n) { /* Nodes are numbered densely on most machines. */
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u", n);
+        if (access(path, F_OK) != 0) { break; }
+        osi_data.numa_nodes = n+1;
+    }
 #endif
 }
 
+uint32_t neo_osi_numa_node(void) {
+#if NEO_OS_LINUX && defined(SYS_getcpu)
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) { return node; }
+#endif
+    return 0;
+}
+
+bool neo_osi_mem_policy(void *p, size_t len, neo_mempolicy_t policy, uint32_t node) {
+    size_t ps = neo_osi->page_size ? neo_osi->page_size : 0x1000;
+    uintptr_t beg = ((uintptr_t)p+ps-1)&~(uintptr_t)(ps-1);
+    uintptr_t end = ((uintptr_t)p+len)&~(uintptr_t)(ps-1);
+    if (!p || end <= beg) { return false; }
+    len = (size_t)(end-beg);
+    bool applied = false;
+#if NEO_OS_LINUX
+#   ifdef MADV_HUGEPAGE
+    if ((policy & NEO_MEMPOLICY_HUGE_PAGES) && len >= (neo_osi->huge_page_size ? neo_osi->huge_page_size : 2u<<20)) {
+        applied |= madvise((void *)beg, len, MADV_HUGEPAGE) == 0;
+    }
+#   endif
+#   ifdef SYS_mbind
+    if ((policy & NEO_MEMPOLICY_NUMA_LOCAL) && neo_osi->numa_nodes > 1 && node < 64) {
+        unsigned long mask = 1ul<<node;
+        applied |= syscall(SYS_mbind, beg, len, 1 /* MPOL_PREFERRED */, &mask, 64+1, 0) == 0; /* The kernel ignores the last bit of maxnode. */
+    }
+#   endif
+#else
+    (void)policy; (void)node;
+#endif
+    return applied;
+}
+
+static volatile int64_t mempolicy_default = NEO_MEMPOLICY_DEFAULT;
+
+void neo_mempolicy_set_default(neo_mempolicy_t policy) {
+    neo_atomic_store(&mempolicy_default, (int64_t)policy, NEO_MEMORD_RELX);
+}
+
+neo_mempolicy_t neo_mempolicy_get_default(void) {
+    return (neo_mempolicy_t)neo_atomic_load(&mempolicy_default, NEO_MEMORD_RELX);
+}
+
 void neo_osi_shutdown(void) {
 
 }
@@ -2012,7 +2075,7 @@ neo_static_assert((SPAN_HEADER_SIZE & (SPAN_HEADER_SIZE - 1)) == 0 && "Span head
 #endif
 
 #ifndef MEM_FIRST_CLASS_HEAPS
-#define MEM_FIRST_CLASS_HEAPS 0
+#define MEM_FIRST_CLASS_HEAPS 1 /* Used for per-isolate heaps (neo_allocator_heap_*). */
 #endif
 
 #define MEM_NO_PRESERVE    1
@@ -2028,8 +2091,6 @@ MEM_ALLOCATOR void *memheap_alloc(memheap_t *heap, size_t size) MEM_ATTRIB_MALLO
 MEM_ALLOCATOR void *memheap_aligned_alloc(memheap_t *heap, size_t alignment, size_t size) MEM_ATTRIB_MALLOC MEM_ATTRIB_ALLOC_SIZE(3);
 MEM_ALLOCATOR void *memheap_calloc(memheap_t *heap, size_t num, size_t size) MEM_ATTRIB_MALLOC MEM_ATTRIB_ALLOC_SIZE2(2, 3);
 MEM_ALLOCATOR void *memheap_aligned_calloc(memheap_t *heap, size_t alignment, size_t num, size_t size) MEM_ATTRIB_MALLOC MEM_ATTRIB_ALLOC_SIZE2(2, 3);
-MEM_ALLOCATOR void *memheap_realloc(memheap_t *heap, void *ptr, size_t size, unsigned flags) MEM_ATTRIB_MALLOC MEM_ATTRIB_ALLOC_SIZE(3);
-MEM_ALLOCATOR void *memheap_aligned_realloc(memheap_t *heap, void *ptr, size_t alignment, size_t size, unsigned flags) MEM_ATTRIB_MALLOC MEM_ATTRIB_ALLOC_SIZE(4);
 void memheap_free(memheap_t *heap, void *ptr);
 void memheap_free_all(memheap_t *heap);
 void memheap_thread_set_current(memheap_t *heap);
@@ -2371,6 +2432,23 @@ struct size_class_use_t {
 typedef struct size_class_use_t size_class_use_t;
 #endif
 
+#define STATS_CLASS_HUGE (SIZE_CLASS_COUNT + 1)
+
+/* Always-on statistics, written without atomics by the thread using the heap. Frees are counted in the heap of the freeing thread. */
+struct heap_stats_t {
+    size_t alloc[SIZE_CLASS_COUNT + 2]; /* Indexed by size class, SIZE_CLASS_LARGE or STATS_CLASS_HUGE. */
+    size_t free[SIZE_CLASS_COUNT + 2];
+    size_t alloc_bytes[2]; /* Large and huge spans. */
+    size_t free_bytes[2];
+    size_t spans_from_cache;
+    size_t spans_from_reserved;
+    size_t spans_from_global;
+    size_t spans_mapped;
+};
+typedef struct heap_stats_t heap_stats_t;
+
+neo_static_assert(SIZE_CLASS_COUNT == NEO_ALLOC_SIZE_CLASS_COUNT && "size class count mismatch");
+
 struct span_t {
     void *free_list;
     uint32_t block_count;
@@ -2435,6 +2513,8 @@ struct heap_t {
 #if MEM_FIRST_CLASS_HEAPS
     span_t*      full_span[SIZE_CLASS_COUNT];
 span_t*      large_huge_span;
+    neo_mempolicy_t policy; /* Placement policy of new mappings. */
+    uint32_t numa_node; /* Preferred node, if policy contains NEO_MEMPOLICY_NUMA_LOCAL. */
 #endif
 #if NEO_ALLOC_ENABLE_ADAPTIVE_THREAD_CACHE || NEO_ALLOC_ENABLE_STATS
     span_use_t span_use[LARGE_CLASS_COUNT];
@@ -2444,6 +2524,7 @@ span_t*      large_huge_span;
     atomic64_t   thread_to_global;
     atomic64_t   global_to_thread;
 #endif
+    heap_stats_t stats;
 };
 
 struct size_class_t {
@@ -2502,6 +2583,11 @@ static heap_t *_memory_orphan_heaps;
 #if MEM_FIRST_CLASS_HEAPS
 static heap_t* _memory_first_class_orphan_heaps;
 #endif
+static atomic64_t _memory_mapped_bytes;
+static atomic64_t _memory_map_calls;
+static atomic64_t _memory_unmap_calls;
+static atomic32_t _memory_stats_lock;
+static heap_stats_t _memory_stats_unowned; /* Frees from threads without a heap. */
 #if NEO_ALLOC_ENABLE_STATS
 static atomic64_t _allocation_counter;
 static atomic64_t _deallocation_counter;
@@ -2648,6 +2734,8 @@ static void *_memmmap(size_t size, size_t *offset) {
     neo_assert(size >= _memory_page_size, "Invalid mmap size");
     void *address = _memory_config.memory_map(size, offset);
     if (neo_likely(address != 0)) {
+        atomic_add64(&_memory_mapped_bytes, (int64_t)size);
+        atomic_add64(&_memory_map_calls, 1);
         _memstat_add_peak(&_mapped_pages, (size >> _memory_page_size_shift), _mapped_pages_peak);
         _memstat_add(&_mapped_total, (size >> _memory_page_size_shift));
     }
@@ -2659,6 +2747,8 @@ static void _memunmap(void *address, size_t size, size_t offset, size_t release)
     neo_assert(!release || (release >= _memory_page_size), "Invalid unmap size");
     if (release) {
         neo_assert(!(release % _memory_page_size), "Invalid unmap size");
+        atomic_add64(&_memory_mapped_bytes, -(int64_t)release);
+        atomic_add64(&_memory_unmap_calls, 1);
         _memstat_sub(&_mapped_pages, (release >> _memory_page_size_shift));
         _memstat_add(&_unmapped_total, (release >> _memory_page_size_shift));
     }
@@ -2873,6 +2963,10 @@ static span_t *_memspan_map_aligned_count(heap_t *heap, size_t span_count) {
     span_t *span = (span_t *)_memmmap(aligned_span_count * _memory_span_size, &align_offset);
     if (!span)
         return 0;
+#if MEM_FIRST_CLASS_HEAPS
+    if (heap->policy) /* Before the span header is touched, so its page is placed by the policy too. */
+        neo_osi_mem_policy(span, aligned_span_count * _memory_span_size, heap->policy, heap->numa_node);
+#endif
     _memspan_initialize(span, aligned_span_count, span_count, align_offset);
     _memstat_inc(&_master_spans);
     if (span_count <= LARGE_CLASS_COUNT)
@@ -3462,6 +3556,7 @@ static span_t *_memheap_extract_new_span(heap_t *heap, heap_size_class_t *heap_s
     if (heap_size_class && heap_size_class->cache) {
         span = heap_size_class->cache;
         heap_size_class->cache = (heap->span_cache.count ? heap->span_cache.span[--heap->span_cache.count] : 0);
+        ++heap->stats.spans_from_cache;
         _meminc_span_statistics(heap, span_count, class_idx);
         return span;
     }
@@ -3474,24 +3569,28 @@ static span_t *_memheap_extract_new_span(heap_t *heap, heap_size_class_t *heap_s
     do {
         span = _memheap_thread_cache_extract(heap, span_count);
         if (neo_likely(span != 0)) {
+            ++heap->stats.spans_from_cache;
             _memstat_inc(&heap->size_class_use[class_idx].spans_from_cache);
             _meminc_span_statistics(heap, span_count, class_idx);
             return span;
         }
         span = _memheap_thread_cache_deferred_extract(heap, span_count);
         if (neo_likely(span != 0)) {
+            ++heap->stats.spans_from_cache;
             _memstat_inc(&heap->size_class_use[class_idx].spans_from_cache);
             _meminc_span_statistics(heap, span_count, class_idx);
             return span;
         }
         span = _memheap_reserved_extract(heap, span_count);
         if (neo_likely(span != 0)) {
+            ++heap->stats.spans_from_reserved;
             _memstat_inc(&heap->size_class_use[class_idx].spans_from_reserved);
             _meminc_span_statistics(heap, span_count, class_idx);
             return span;
         }
         span = _memheap_global_cache_extract(heap, span_count);
         if (neo_likely(span != 0)) {
+            ++heap->stats.spans_from_global;
             _memstat_inc(&heap->size_class_use[class_idx].spans_from_cache);
             _meminc_span_statistics(heap, span_count, class_idx);
             return span;
@@ -3499,6 +3598,7 @@ static span_t *_memheap_extract_new_span(heap_t *heap, heap_size_class_t *heap_s
         ++span_count;
     } while (span_count <= limit_span_count);
     span = _memspan_map(heap, base_span_count);
+    ++heap->stats.spans_mapped;
     _meminc_span_statistics(heap, base_span_count, class_idx);
     _memstat_inc(&heap->size_class_use[class_idx].spans_map_calls);
     return span;
@@ -3780,6 +3880,7 @@ static void *_memallocate_small(heap_t *heap, size_t size) {
     neo_assert(heap, "No thread heap");
     const uint32_t class_idx = (uint32_t)((size + (SMALL_GRANULARITY - 1)) >> SMALL_GRANULARITY_SHIFT);
     heap_size_class_t *heap_size_class = heap->size_class + class_idx;
+    ++heap->stats.alloc[class_idx];
     _memstat_inc_alloc(heap, class_idx);
     if (neo_likely(heap_size_class->free_list != 0))
         return free_list_pop(&heap_size_class->free_list);
@@ -3792,6 +3893,7 @@ static void *_memallocate_medium(heap_t *heap, size_t size) {
                                          ((size - (SMALL_SIZE_LIMIT + 1)) >> MEDIUM_GRANULARITY_SHIFT));
     const uint32_t class_idx = _memory_size_class[base_idx].class_idx;
     heap_size_class_t *heap_size_class = heap->size_class + class_idx;
+    ++heap->stats.alloc[class_idx];
     _memstat_inc_alloc(heap, class_idx);
     if (neo_likely(heap_size_class->free_list != 0))
         return free_list_pop(&heap_size_class->free_list);
@@ -3812,6 +3914,8 @@ static void *_memallocate_large(heap_t *heap, size_t size) {
     neo_assert(span->span_count >= span_count, "Internal failure");
     span->size_class = SIZE_CLASS_LARGE;
     span->heap = heap;
+    ++heap->stats.alloc[SIZE_CLASS_LARGE];
+    heap->stats.alloc_bytes[0] += span->span_count * _memory_span_size;
 
 #if MEM_FIRST_CLASS_HEAPS
     _memspan_double_link_list_add(&heap->large_huge_span, span);
@@ -3832,11 +3936,17 @@ static void *_memallocate_huge(heap_t *heap, size_t size) {
     span_t *span = (span_t *)_memmmap(num_pages * _memory_page_size, &align_offset);
     if (!span)
         return span;
+#if MEM_FIRST_CLASS_HEAPS
+    if (heap->policy)
+        neo_osi_mem_policy(span, num_pages * _memory_page_size, heap->policy, heap->numa_node);
+#endif
 
     span->size_class = SIZE_CLASS_HUGE;
     span->span_count = (uint32_t)num_pages;
     span->align_offset = (uint32_t)align_offset;
     span->heap = heap;
+    ++heap->stats.alloc[STATS_CLASS_HUGE];
+    heap->stats.alloc_bytes[1] += num_pages * _memory_page_size;
     _memstat_add_peak(&_huge_pages_current, num_pages, _huge_pages_peak);
 
 #if MEM_FIRST_CLASS_HEAPS
@@ -3949,6 +4059,8 @@ static void *_memaligned_allocate(heap_t *heap, size_t alignment, size_t size) {
     span->span_count = (uint32_t)num_pages;
     span->align_offset = (uint32_t)align_offset;
     span->heap = heap;
+    ++heap->stats.alloc[STATS_CLASS_HUGE];
+    heap->stats.alloc_bytes[1] += num_pages * _memory_page_size;
     _memstat_add_peak(&_huge_pages_current, num_pages, _huge_pages_peak);
 
 #if MEM_FIRST_CLASS_HEAPS
@@ -3961,6 +4073,26 @@ static void *_memaligned_allocate(heap_t *heap, size_t alignment, size_t size) {
     return ptr;
 }
 
+static NEO_NOINLINE void _memstats_free_unowned(uint32_t idx, size_t bytes) {
+    while (!atomic_cas32_acquire(&_memory_stats_lock, 1, 0))
+        _memspin();
+    ++_memory_stats_unowned.free[idx];
+    if (idx >= SIZE_CLASS_LARGE)
+        _memory_stats_unowned.free_bytes[idx - SIZE_CLASS_LARGE] += bytes;
+    atomic_store32_release(&_memory_stats_lock, 0);
+}
+
+static NEO_AINLINE void _memstats_free(uint32_t idx, size_t bytes) {
+    heap_t *heap = get_thread_heap_raw();
+    if (neo_unlikely(!heap)) {
+        _memstats_free_unowned(idx, bytes);
+        return;
+    }
+    ++heap->stats.free[idx];
+    if (idx >= SIZE_CLASS_LARGE)
+        heap->stats.free_bytes[idx - SIZE_CLASS_LARGE] += bytes;
+}
+
 static void _memdeallocate_direct_small_or_medium(span_t *span, void *block) {
     heap_t *heap = span->heap;
     neo_assert(heap->owner_thread == get_thread_id() || !heap->owner_thread || heap->finalize, "Internal failure");
@@ -4342,6 +4474,7 @@ int meminitialize_config(const neo_alloc_config_t *config) {
     _huge_pages_peak = 0;
 #endif
     memset(_memory_heaps, 0, sizeof(_memory_heaps));
+    memset(&_memory_stats_unowned, 0, sizeof(_memory_stats_unowned));
     atomic_store32_release(&_memory_global_lock, 0);
 
     memthread_initialize();
@@ -4712,31 +4845,9 @@ memheap_aligned_calloc(memheap_t* heap, size_t alignment, size_t num, size_t siz
     return block;
 }
 
-extern inline MEM_ALLOCATOR void*
-memheap_realloc(memheap_t* heap, void* ptr, size_t size, unsigned int flags) {
-#if NEO_ALLOC_ENABLE_VALIDATION
-    if (size >= MAX_ALLOC_SIZE) {
-        errno = EINVAL;
-        return ptr;
-    }
-#endif
-    return _memreallocate(heap, ptr, size, 0, flags);
-}
-
-extern inline MEM_ALLOCATOR void*
-memheap_aligned_realloc(memheap_t* heap, void* ptr, size_t alignment, size_t size, unsigned int flags) {
-#if NEO_ALLOC_ENABLE_VALIDATION
-    if ((size + alignment < size) || (alignment > _memory_page_size)) {
-        errno = EINVAL;
-        return 0;
-    }
-#endif
-    return _memaligned_reallocate(heap, ptr, alignment, size, 0, flags);
-}
-
 extern inline void memheap_free(memheap_t* heap, void* ptr) {
     (void)sizeof(heap);
-    _memdeallocate(ptr);
+    neo_allocator_free(ptr);
 }
 
 extern inline void memheap_free_all(memheap_t* heap) {
@@ -4745,6 +4856,17 @@ extern inline void memheap_free_all(memheap_t* heap) {
 
     _memheap_cache_adopt_deferred(heap, 0);
 
+    for (size_t iclass = 0; iclass < SIZE_CLASS_COUNT; ++iclass) { /* Count the dropped blocks as freed. */
+        size_t live = 0;
+        for (span = heap->size_class[iclass].partial_span; span; span = span->next)
+            live += span->used_count - span->list_size;
+        for (span = heap->full_span[iclass]; span; span = span->next)
+            live += span->used_count - span->list_size;
+        for (void *blk = heap->size_class[iclass].free_list; blk; blk = *(void **)blk)
+            --live;
+        heap->stats.free[iclass] += live;
+    }
+
     for (size_t iclass = 0; iclass < SIZE_CLASS_COUNT; ++iclass) {
         span = heap->size_class[iclass].partial_span;
         while (span) {
@@ -4766,10 +4888,15 @@ extern inline void memheap_free_all(memheap_t* heap) {
     span = heap->large_huge_span;
     while (span) {
         next_span = span->next;
-        if (neo_unlikely(span->size_class == SIZE_CLASS_HUGE))
+        if (neo_unlikely(span->size_class == SIZE_CLASS_HUGE)) {
+            ++heap->stats.free[STATS_CLASS_HUGE];
+            heap->stats.free_bytes[1] += span->span_count * _memory_page_size;
             _memdeallocate_huge(span);
-        else
+        } else {
+            ++heap->stats.free[SIZE_CLASS_LARGE];
+            heap->stats.free_bytes[0] += span->span_count * _memory_span_size;
             _memheap_cache_insert(heap, span);
+        }
         span = next_span;
     }
     heap->large_huge_span = 0;
@@ -4843,6 +4970,11 @@ void neo_allocator_init(void) {
     neo_atomic_store(&alloc_init, 1, NEO_MEMORD_RELX);
 }
 
+void neo_allocator_init_config(const neo_alloc_config_t *config) {
+    meminitialize_config(config);
+    neo_atomic_store(&alloc_init, 1, NEO_MEMORD_RELX);
+}
+
 void neo_allocator_shutdown(void) {
     memfinalize();
 }
@@ -4921,6 +5053,8 @@ void *neo_allocator_alloc_aligned(size_t len, size_t align) {
     span->span_count = (uint32_t)num_pages;
     span->align_offset = (uint32_t)align_offset;
     span->heap = heap;
+    ++heap->stats.alloc[STATS_CLASS_HUGE];
+    heap->stats.alloc_bytes[1] += num_pages * _memory_page_size;
     _memstat_add_peak(&_huge_pages_current, num_pages, _huge_pages_peak);
 #if MEM_FIRST_CLASS_HEAPS
     _memspan_double_link_list_add(&heap->large_huge_span, span);
@@ -5042,14 +5176,108 @@ void neo_allocator_free(void *blk) {
     span_t *span = (span_t *)((uintptr_t)blk & _memory_span_mask);
     if (neo_unlikely(!span)) { return; }
     if (neo_likely(span->size_class < SIZE_CLASS_COUNT)) {
+        _memstats_free(span->size_class, 0);
         _memdeallocate_small_or_medium(span, blk);
     } else if (span->size_class == SIZE_CLASS_LARGE) {
+        _memstats_free(SIZE_CLASS_LARGE, span->span_count * _memory_span_size);
         _memdeallocate_large(span);
     } else {
+        _memstats_free(STATS_CLASS_HUGE, span->span_count * _memory_page_size);
         _memdeallocate_huge(span);
     }
 }
 
+static void _memstats_accumulate(heap_stats_t *dst, const heap_stats_t *src) {
+    for (size_t i = 0; i < SIZE_CLASS_COUNT + 2; ++i) {
+        dst->alloc[i] += src->alloc[i];
+        dst->free[i] += src->free[i];
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        dst->alloc_bytes[i] += src->alloc_bytes[i];
+        dst->free_bytes[i] += src->free_bytes[i];
+    }
+    dst->spans_from_cache += src->spans_from_cache;
+    dst->spans_from_reserved += src->spans_from_reserved;
+    dst->spans_from_global += src->spans_from_global;
+    dst->spans_mapped += src->spans_mapped;
+}
+
+static size_t _memstats_diff(size_t a, size_t b) { return a > b ? a - b : 0; } /* Racy reads may briefly see more frees than allocations. */
+
+void neo_allocator_stats(neo_alloc_stats_t *out) {
+    neo_dassert(out != NULL, "out is NULL");
+    check_allocator_online();
+    heap_stats_t sum;
+    memset(&sum, 0, sizeof(sum));
+    while (!atomic_cas32_acquire(&_memory_stats_lock, 1, 0))
+        _memspin();
+    _memstats_accumulate(&sum, &_memory_stats_unowned);
+    atomic_store32_release(&_memory_stats_lock, 0);
+    while (!atomic_cas32_acquire(&_memory_global_lock, 1, 0)) /* New heaps are linked under the global lock. */
+        _memspin();
+    for (size_t list_idx = 0; list_idx < NEO_ALLOC_HEAP_ARRAY_SIZE; ++list_idx)
+        for (heap_t *heap = _memory_heaps[list_idx]; heap; heap = heap->next_heap)
+            _memstats_accumulate(&sum, &heap->stats);
+    atomic_store32_release(&_memory_global_lock, 0);
+    memset(out, 0, sizeof(*out));
+    for (size_t iclass = 0; iclass < SIZE_CLASS_COUNT; ++iclass) {
+        neo_alloc_size_class_stats_t *cls = out->size_class + iclass;
+        cls->block_size = _memory_size_class[iclass].block_size;
+        cls->alloc_total = sum.alloc[iclass];
+        cls->free_total = sum.free[iclass];
+        cls->live = _memstats_diff(cls->alloc_total, cls->free_total);
+        out->allocated += cls->live * cls->block_size;
+    }
+    for (size_t i = 0; i < SIZE_CLASS_COUNT + 2; ++i) {
+        out->alloc_calls += sum.alloc[i];
+        out->free_calls += sum.free[i];
+    }
+    out->large_live = _memstats_diff(sum.alloc[SIZE_CLASS_LARGE], sum.free[SIZE_CLASS_LARGE]);
+    out->large_bytes = _memstats_diff(sum.alloc_bytes[0], sum.free_bytes[0]);
+    out->huge_live = _memstats_diff(sum.alloc[STATS_CLASS_HUGE], sum.free[STATS_CLASS_HUGE]);
+    out->huge_bytes = _memstats_diff(sum.alloc_bytes[1], sum.free_bytes[1]);
+    out->allocated += out->large_bytes + out->huge_bytes;
+    int64_t mapped = atomic_load64(&_memory_mapped_bytes);
+    out->mapped = mapped > 0 ? (size_t)mapped : 0;
+    out->map_calls = (size_t)atomic_load64(&_memory_map_calls);
+    out->unmap_calls = (size_t)atomic_load64(&_memory_unmap_calls);
+    out->span_cache_hits = sum.spans_from_cache;
+    out->span_reserve_hits = sum.spans_from_reserved;
+    out->global_cache_hits = sum.spans_from_global;
+    out->span_cache_misses = sum.spans_mapped;
+}
+
+neo_memheap_t *neo_allocator_heap_acquire(void) {
+    check_allocator_online();
+    heap_t *heap = memheap_acquire();
+    heap->owner_thread = get_thread_id(); /* Frees from other threads are deferred, instead of racing with the owner. */
+    heap->policy = NEO_MEMPOLICY_DEFAULT;
+    heap->numa_node = 0;
+    return (neo_memheap_t *)heap;
+}
+
+void neo_allocator_heap_release(neo_memheap_t *heap) {
+    check_allocator_online();
+    memheap_release((heap_t *)heap);
+}
+
+void neo_allocator_heap_set_policy(neo_memheap_t *heap, neo_mempolicy_t policy, uint32_t node) {
+    neo_dassert(heap != NULL, "heap is NULL");
+    ((heap_t *)heap)->policy = policy;
+    ((heap_t *)heap)->numa_node = node;
+}
+
+void *neo_allocator_heap_alloc(neo_memheap_t *heap, size_t len) {
+    neo_dassert(heap != NULL, "heap is NULL");
+    neo_assert(len != 0 && len < MAX_ALLOC_SIZE, "Allocation with invalid size: %zub, max: %zub", len, MAX_ALLOC_SIZE);
+    return _memallocate((heap_t *)heap, len);
+}
+
+void neo_allocator_heap_free_all(neo_memheap_t *heap) {
+    neo_dassert(heap != NULL, "heap is NULL");
+    memheap_free_all((heap_t *)heap);
+}
+
 void neo_allocator_thread_enter(void) {
     check_allocator_online();
     memthread_initialize();
@@ -457,11 +457,27 @@ extern NEO_EXPORT NEO_COLDPROC NEO_NORET void neo_panic(const char *msg, ...);
 /* ---- OS interface ---- */
 typedef struct neo_osi_t {
     uint32_t page_size;
+    uint32_t huge_page_size; /* Size of a transparent huge page. */
+    uint32_t numa_nodes; /* Number of NUMA nodes, 1 if unknown. */
 } neo_osi_t;
 
+/*
+** Memory placement policy for large mappings (VM stacks, GC heaps and large objects).
+** Both policies are hints: They're ignored on platforms without support and failures are not reported to the caller.
+*/
+typedef enum neo_mempolicy_t {
+    NEO_MEMPOLICY_DEFAULT = 0,
+    NEO_MEMPOLICY_HUGE_PAGES = 1<<0, /* Back ranges of at least a huge page by transparent huge pages (fewer TLB misses). */
+    NEO_MEMPOLICY_NUMA_LOCAL = 1<<1 /* Prefer the NUMA node of the thread which owns the memory (no cross-socket traffic). */
+} neo_mempolicy_t;
+
 extern NEO_EXPORT void neo_osi_init(void);
 extern NEO_EXPORT void neo_osi_shutdown(void);
 extern NEO_EXPORT const neo_osi_t *neo_osi;
+extern NEO_EXPORT uint32_t neo_osi_numa_node(void); /* NUMA node of the calling thread, 0 if unknown. */
+extern NEO_EXPORT bool neo_osi_mem_policy(void *p, size_t len, neo_mempolicy_t policy, uint32_t node); /* Apply policy to all whole pages inside [p, p+len). Returns false if no advice was applied. */
+extern NEO_EXPORT void neo_mempolicy_set_default(neo_mempolicy_t policy); /* Policy of isolates (and GC contexts) created afterwards. */
+extern NEO_EXPORT neo_mempolicy_t neo_mempolicy_get_default(void);
 extern NEO_EXPORT uint64_t neo_hp_clock_ms(void);
 extern NEO_EXPORT uint64_t neo_hp_clock_us(void);
 
@@ -527,6 +543,38 @@ typedef struct neo_alloc_thread_stats_t {
     } size_use[128];
 } neo_alloc_thread_stats_t;
 
+/*
+** Allocator statistics, available in all builds.
+** Counters are kept per heap without atomics and summed up on query,
+** so the values are approximate while other threads allocate or free.
+*/
+#define NEO_ALLOC_SIZE_CLASS_COUNT 126
+
+typedef struct neo_alloc_size_class_stats_t {
+    size_t block_size;
+    size_t alloc_total;
+    size_t free_total;
+    size_t live; /* Blocks in use: alloc_total - free_total. */
+} neo_alloc_size_class_stats_t;
+
+typedef struct neo_alloc_stats_t {
+    size_t allocated; /* Bytes of live blocks, rounded up to size class or span. */
+    size_t mapped; /* Bytes currently mapped from the OS. */
+    size_t map_calls;
+    size_t unmap_calls;
+    size_t alloc_calls;
+    size_t free_calls;
+    size_t large_live;
+    size_t large_bytes;
+    size_t huge_live;
+    size_t huge_bytes;
+    size_t span_cache_hits; /* New spans taken from the thread cache. */
+    size_t span_reserve_hits; /* New spans taken from the heap reserve. */
+    size_t global_cache_hits; /* New spans taken from the global cache. */
+    size_t span_cache_misses; /* New spans which had to be mapped. */
+    neo_alloc_size_class_stats_t size_class[NEO_ALLOC_SIZE_CLASS_COUNT];
+} neo_alloc_stats_t;
+
 typedef struct neo_alloc_config_t {
     void *(*memory_map)(size_t size, size_t *offset);
     void (*memory_unmap)(void *address, size_t size, size_t offset, size_t release);
@@ -540,6 +588,7 @@ typedef struct neo_alloc_config_t {
 } neo_alloc_config_t;
 
 extern NEO_EXPORT void neo_allocator_init(void); /* Initialize global memory allocator. */
+extern NEO_EXPORT void neo_allocator_init_config(const neo_alloc_config_t *config); /* Initialize global memory allocator with config, enable_huge_pages maps all spans with explicit huge pages (MAP_HUGETLB, falls back to THP). Must be called before any allocation. */
 extern NEO_EXPORT void neo_allocator_shutdown(void); /* Shutdown global memory allocator. */
 extern NEO_EXPORT NEO_NODISCARD NEO_ALLOC_ROUTINE NEO_ALLOC_ROUTINE_SIZE(1) NEO_HOTPROC void *neo_allocator_alloc(size_t len);
 extern NEO_EXPORT NEO_NODISCARD NEO_ALLOC_ROUTINE NEO_ALLOC_ROUTINE_SIZE(1) NEO_HOTPROC void *neo_allocator_alloc_aligned(size_t len, size_t align);
@@ -547,6 +596,19 @@ extern NEO_EXPORT NEO_NODISCARD NEO_ALLOC_ROUTINE NEO_ALLOC_ROUTINE_SIZE(2) NEO_
 extern NEO_EXPORT NEO_NODISCARD NEO_ALLOC_ROUTINE NEO_ALLOC_ROUTINE_SIZE(2) NEO_HOTPROC void *neo_allocator_realloc_aligned(void *blk, size_t len, size_t align);
 extern NEO_EXPORT NEO_NODISCARD size_t neo_allocator_bin_useable_size(void *blk);
 extern NEO_EXPORT void neo_allocator_free(void *blk);
+extern NEO_EXPORT void neo_allocator_stats(neo_alloc_stats_t *out); /* Sum up statistics of all heaps. */
+
+/*
+** First-class heaps: Allocations of a heap can be released all at once with neo_allocator_heap_free_all.
+** A heap is owned by the thread which acquired it, only the owner may allocate from it.
+** Blocks are freed with neo_allocator_free from any thread, frees from other threads are deferred to the owner.
+*/
+typedef struct neo_memheap_t neo_memheap_t;
+extern NEO_EXPORT NEO_NODISCARD neo_memheap_t *neo_allocator_heap_acquire(void);
+extern NEO_EXPORT void neo_allocator_heap_release(neo_memheap_t *heap); /* Release heap, live blocks must be freed before. */
+extern NEO_EXPORT NEO_NODISCARD NEO_ALLOC_ROUTINE NEO_ALLOC_ROUTINE_SIZE(2) NEO_HOTPROC void *neo_allocator_heap_alloc(neo_memheap_t *heap, size_t len);
+extern NEO_EXPORT void neo_allocator_heap_free_all(neo_memheap_t *heap); /* Free all blocks of the heap at once. */
+extern NEO_EXPORT void neo_allocator_heap_set_policy(neo_memheap_t *heap, neo_mempolicy_t policy, uint32_t node); /* Placement policy for memory the heap maps from now on. Spans reused from the global cache keep their placement. */
 extern NEO_EXPORT void neo_allocator_thread_enter(void); /* Setup thread-local allocator state for a new thread. */
 extern NEO_EXPORT void neo_allocator_thread_leave(void); /* Setup thread-local allocator state for a new thread. */
 extern NEO_EXPORT void neo_allocator_memthread_collect(void); /* Collect local heaps. */
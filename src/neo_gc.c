@@ -2,6 +2,12 @@
 
 #include "neo_gc.h"
 
+#if NEO_OS_WINDOWS
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#endif
+
 #if GC_DBG
 #   define gctrace(msg, ...) neo_info("[gc] " msg, ## __VA_ARGS__)
 #else
@@ -15,40 +21,83 @@ static NEO_AINLINE size_t probe_dist(const gc_context_t* self, size_t i, size_t
     return (size_t)v;
 }
 
+#if NEO_COM_GCC || NEO_COM_CLANG
+#   define gc_prefetch(p) __builtin_prefetch((p), 0, 3)
+#   define gc_load_ref(pp) __atomic_load_n((pp), __ATOMIC_RELAXED) /* Reference slots are loaded atomically, mutator stores might race with the concurrent marker. */
+#   define gc_store_ref_relaxed(pp, v) __atomic_store_n((pp), (v), __ATOMIC_RELAXED)
+#else
+#   define gc_prefetch(p) (void)(p)
+#   define gc_load_ref(pp) (*(pp))
+#   define gc_store_ref_relaxed(pp, v) (*(pp) = (v))
+#endif
+
 static void gc_mark_ptr(gc_context_t *self, const void *ptr);
 static NEO_AINLINE void scan_region(gc_context_t *self, const void *p, size_t len) {
     neo_dassert(self != NULL && p != NULL, "Invalid arguments");
     const void **pp = (const void **)p;
     const void **end = (const void **)p+len;
-    while (pp < end) {
-        gc_mark_ptr(self, *pp++);
+    for (; pp < end; ++pp) {
+        gc_mark_ptr(self, gc_load_ref(pp));
     }
 }
 
 neo_static_assert(GC_ALLOC_GRANULARITY == sizeof(void *)); /* By coincidence, granule size == sizeof(void *) */
 #define ptrsize(x) ((x).grasize) /* Object size in pointer size. (granules to bytes / sizeof void*), which is (granules<<3)>>3 = granules. */
 
-gc_fatptr_t *gc_resolve_ptr(gc_context_t *self, const void *ptr) {
-    neo_dassert(self != NULL, "self is NULL");
+/* Fibonacci hashing into the power of two table, the multiplication spreads the few entropic bits of aligned addresses into the high bits. */
+#define gc_slot(self, ptr) ((size_t)(((uint64_t)gc_hash(ptr)*UINT64_C(0x9e3779b97f4a7c15))>>(self)->slot_shift))
+#define gc_next_slot(self, i) (((i)+1)&((self)->slots-1))
+
+/* Lookup object, the number of inspected slots is added to <probes>. */
+static NEO_AINLINE gc_fatptr_t *lookup_ptr_probes(gc_context_t *self, const void *ptr, size_t *probes) {
+    neo_dassert(self != NULL && self->slots, "Invalid arguments");
     size_t i, j, h;
-    i = gc_hash(ptr) % self->slots; j = 0;
+    i = gc_slot(self, ptr); j = 0;
     for (;;) {
         h = self->trackedallocs[i].hash;
-        if (neo_unlikely(h == 0 || j > probe_dist(self, i, h))) { return NULL; }
-        if (self->trackedallocs[i].ptr == ptr) { return self->trackedallocs+i; }
-        i = (i+1) % self->slots; ++j;
+        if (neo_unlikely(h == 0 || j > probe_dist(self, i, h))) { *probes += j+1; return NULL; }
+        if (self->trackedallocs[i].ptr == ptr) { *probes += j+1; return self->trackedallocs+i; }
+        i = gc_next_slot(self, i); ++j;
+    }
+}
+
+static NEO_AINLINE gc_fatptr_t *lookup_ptr(gc_context_t *self, const void *ptr) {
+    size_t probes = 0;
+    return lookup_ptr_probes(self, ptr, &probes);
+}
+
+/* Binary search large object. */
+static gc_fatptr_t *large_find(gc_context_t *self, const void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    size_t lo = 0, hi = self->large_len;
+    while (lo < hi) {
+        size_t mid = lo+((hi-lo)>>1);
+        if ((uintptr_t)self->large[mid].ptr < (uintptr_t)ptr) { lo = mid+1; }
+        else if (self->large[mid].ptr == ptr) { return self->large+mid; }
+        else { hi = mid; }
     }
+    return NULL;
+}
+
+#define large_candidate(self, ptr) ((self)->large_len && !((uintptr_t)(ptr)&((self)->page_size-1))) /* Large objects start at a page boundary. */
+
+static NEO_AINLINE gc_fatptr_t *resolve_ptr(gc_context_t *self, const void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_fatptr_t *p = neo_likely(self->slots) ? lookup_ptr(self, ptr) : NULL;
+    return !p && large_candidate(self, ptr) ? large_find(self, ptr) : p;
 }
 
-static NEO_HOTPROC void attach_ptr(gc_context_t *self, void *ptr, gc_grasize_t size, gc_flags_t flags) {
+static NEO_HOTPROC void attach_ptr(gc_context_t *self, void *ptr, gc_grasize_t size, gc_flags_t flags, uint32_t oid) {
     neo_dassert(self != NULL, "self is NULL");
     gc_fatptr_t item, tmp;
     size_t h, p, i, j;
-    i = gc_hash(ptr) % self->slots; j = 0;
+    i = gc_slot(self, ptr); j = 0;
     item.ptr = ptr;
     item.flags = flags;
+    item.oid = oid&0xffffff; /* 24-bit field, the ID is checked on allocation. */
     item.grasize = size;
     item.hash = (uint32_t)(i+1);
+    item.span = 0;
     for (;;) {
         h = self->trackedallocs[i].hash;
         if (h == 0) { self->trackedallocs[i] = item; return; }
@@ -60,7 +109,7 @@ static NEO_HOTPROC void attach_ptr(gc_context_t *self, void *ptr, gc_grasize_t s
             item = tmp;
             j = p;
         }
-        i = (i+1) % self->slots;
+        i = gc_next_slot(self, i);
         ++j;
     }
 }
@@ -68,11 +117,8 @@ static NEO_HOTPROC void attach_ptr(gc_context_t *self, void *ptr, gc_grasize_t s
 static void detach_ptr(gc_context_t *self, void *ptr) {
     neo_dassert(self != NULL, "self is NULL");
     size_t i, j, h, nj, nh;
-    if (neo_unlikely(self->alloc_len == 0)) { return; }
-    for (i = 0; i < self->free_len; ++i) {
-        if (self->freelist[i].ptr == ptr) { self->freelist[i].ptr = NULL; }
-    }
-    i = gc_hash(ptr) % self->slots; j = 0;
+    if (neo_unlikely(self->table_len == 0)) { return; }
+    i = gc_slot(self, ptr); j = 0;
     for (;;) {
         h = self->trackedallocs[i].hash;
         if (h == 0 || j > probe_dist(self, i, h)) { return; }
@@ -80,7 +126,7 @@ static void detach_ptr(gc_context_t *self, void *ptr) {
             memset(self->trackedallocs + i, 0, sizeof(*self->trackedallocs));
             j = i;
             for (;;) {
-                nj = (j+1) % self->slots;
+                nj = gc_next_slot(self, j);
                 nh = self->trackedallocs[nj].hash;
                 if (nh && probe_dist(self, nj, nh) > 0) {
                     memcpy(self->trackedallocs + j, self->trackedallocs + nj, sizeof(*self->trackedallocs));
@@ -90,43 +136,595 @@ static void detach_ptr(gc_context_t *self, void *ptr) {
                     break;
                 }
             }
-            self->alloc_len--;
+            --self->table_len;
             return;
         }
-        i = (i+1) % self->slots;
+        i = gc_next_slot(self, i);
         ++j;
     }
 }
 
-static const uint32_t prime_lut[] = {
-    0x0,0x1,0x5,0xb,
-    0x17,0x35,0x65,0xc5,
-    0x185, 0x2ab, 0x4eb, 0x971, 0x127d,
-    0x249b,0x48b9,0x90e9,0x1216d, 0x24269,
-    0x484a3, 0x90893, 0x10c8e9, 0x2191cd, 0x432395,0x864713
+/* ---- Nursery ---- */
+
+typedef struct gc_nursery_block_t gc_nursery_block_t;
+#define GC_NURSERY_BITMAP_LEN (GC_NURSERY_BLOCK_SIZE/GC_ALLOC_GRANULARITY/64) /* 64-bit words per side bitmap, one bit per granule. */
+struct gc_nursery_block_t { /* Header at the start of each nursery block. */
+    gc_nursery_block_t *prev;
+    gc_nursery_block_t *next;
+    size_t live; /* Number of live objects inside this block. */
+    uint64_t starts[GC_NURSERY_BITMAP_LEN]; /* Side bitmap: Granules at which a live object starts. */
+    uint64_t marks[GC_NURSERY_BITMAP_LEN]; /* Side bitmap: Mark bits of the objects, cleared after each sweep. */
+    uint64_t leafs[GC_NURSERY_BITMAP_LEN]; /* Side bitmap: GCF_LEAF of the objects, so the marker doesn't read the header. */
+    uint64_t olds[GC_NURSERY_BITMAP_LEN]; /* Side bitmap: GCF_OLD of the objects. */
+    uint64_t lines[GC_NURSERY_LINES/64]; /* Lines occupied by the header or survivors of the last sweep. */
+    gc_nursery_block_t *rprev; /* Links inside the recycle list. */
+    gc_nursery_block_t *rnext;
+    bool recyclable; /* Is the block inside the recycle list? */
 };
+#define GC_NURSERY_HEADER ((sizeof(gc_nursery_block_t)+GC_ALLOC_GRANULARITY-1)&~(size_t)(GC_ALLOC_GRANULARITY-1)) /* Objects start after the granule aligned header. */
+#define gc_nursery_block_of(p) ((gc_nursery_block_t *)((uintptr_t)(p)&~(uintptr_t)(GC_NURSERY_BLOCK_SIZE-1)))
 
-static size_t gc_ideal_size(const gc_context_t* self, size_t size) {
+/*
+** Each nursery object is preceded by a header granule, which holds what the table entry holds for other objects.
+** Nursery objects are never inserted into the table, the header is written by the allocation and read by the marker and the sweep.
+*/
+typedef struct gc_nursery_hdr_t {
+    gc_grasize_t grasize; /* Size in granules, without the header. */
+    gc_flags_t flags : 8; /* Flags, always including GCF_NURSERY. GCF_LEAF and GCF_OLD are kept in the side bitmaps of the block. */
+    uint32_t oid : 24; /* Object layout ID. */
+} gc_nursery_hdr_t;
+#define gc_nursery_hdr_of(p) ((gc_nursery_hdr_t *)(p)-1)
+neo_static_assert(sizeof(gc_nursery_hdr_t) == GC_ALLOC_GRANULARITY);
+neo_static_assert((GC_NURSERY_BLOCK_SIZE&(GC_NURSERY_BLOCK_SIZE-1)) == 0 && "GC_NURSERY_BLOCK_SIZE must be a power of two");
+neo_static_assert(GC_NURSERY_HEADER+sizeof(gc_nursery_hdr_t)+gc_granules2bytes(GC_NURSERY_MAX_GRANULES) <= GC_NURSERY_BLOCK_SIZE);
+neo_static_assert(GC_NURSERY_LINE_SIZE >= sizeof(gc_nursery_hdr_t)+gc_granules2bytes(GC_NURSERY_MAX_GRANULES) && (GC_NURSERY_LINES&63) == 0);
+#define GC_NURSERY_HEADER_LINES ((GC_NURSERY_HEADER+GC_NURSERY_LINE_SIZE-1)/GC_NURSERY_LINE_SIZE) /* Lines occupied by the block header. */
+#define gc_nursery_granule(blk, p) ((size_t)((uintptr_t)(p)-(uintptr_t)(blk))>>3) /* Granule index of an address inside its block. */
+#define bitmap_test(m, i) ((m)[(i)>>6]&(1ull<<((i)&63)))
+#define bitmap_set(m, i) ((m)[(i)>>6] |= 1ull<<((i)&63))
+#define bitmap_clear(m, i) ((m)[(i)>>6] &= ~(1ull<<((i)&63)))
+
+/* Index of the lowest set bit, <w> must not be 0. */
+static NEO_AINLINE size_t bitmap_ctz(uint64_t w) {
+    uint32_t lo = (uint32_t)w;
+    return lo ? (size_t)neo_bsf32(lo) : 32+(size_t)neo_bsf32((uint32_t)(w>>32));
+}
+
+/* Visit index <i> of each set bit of a bitmap of <len> 64-bit words. Each word is read once, so visited bits may be cleared. */
+#define bitmap_foreach(m, len, i) \
+    for (size_t i##_w = 0; i##_w < (len); ++i##_w) \
+        for (uint64_t i##_m = (m)[i##_w]; i##_m; i##_m &= i##_m-1) \
+            for (size_t i = (i##_w<<6)+bitmap_ctz(i##_m), i##_once = 1; i##_once; i##_once = 0)
+
+/*
+** Set of all nursery blocks (including cached spare blocks), open addressing with linear probing, keyed by block address.
+** Used to check if an arbitrary (conservative) pointer points into a nursery block, before the masked block header is touched.
+*/
+#define nursery_set_slot(self, blk) ((size_t)(((uint64_t)(uintptr_t)(blk)*UINT64_C(0x9e3779b97f4a7c15))>>32)&((self)->nursery_set_cap-1))
+
+static NEO_AINLINE bool nursery_set_contains(const gc_context_t *self, const gc_nursery_block_t *blk) {
     neo_dassert(self != NULL, "self is NULL");
-    size = (size_t)((double)(size+1)/self->loadfactor);
-    for (size_t i = 0; i < sizeof(prime_lut)/sizeof(*prime_lut); ++i) {
-        if (prime_lut[i] >= size) { return prime_lut[i]; }
+    if (neo_unlikely(!self->nursery_set_len)) { return false; }
+    for (size_t i = nursery_set_slot(self, blk); self->nursery_set[i]; i = (i+1)&(self->nursery_set_cap-1)) {
+        if (self->nursery_set[i] == (uintptr_t)blk) { return true; }
     }
-    size_t last = prime_lut[sizeof(prime_lut)/sizeof(*prime_lut)-1];
-    for (size_t i = 0; ; ++i) {
-        if (last*i >= size) { return last*i; }
+    return false;
+}
+
+static void nursery_set_put(gc_context_t *self, uintptr_t blk) {
+    size_t i = nursery_set_slot(self, blk);
+    while (self->nursery_set[i]) { i = (i+1)&(self->nursery_set_cap-1); }
+    self->nursery_set[i] = blk;
+}
+
+static void nursery_set_insert(gc_context_t *self, const gc_nursery_block_t *blk) {
+    neo_dassert(self != NULL && blk != NULL, "Invalid arguments");
+    if ((self->nursery_set_len+1)<<1 > self->nursery_set_cap) { /* Keep the load below 50 %, so probe sequences stay short. */
+        uintptr_t *old = self->nursery_set;
+        size_t old_cap = self->nursery_set_cap;
+        self->nursery_set_cap = old_cap ? old_cap<<1 : 1<<4;
+        self->nursery_set = neo_memalloc(NULL, self->nursery_set_cap*sizeof(*self->nursery_set));
+        memset(self->nursery_set, 0, self->nursery_set_cap*sizeof(*self->nursery_set));
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i]) { nursery_set_put(self, old[i]); }
+        }
+        neo_memalloc(old, 0);
+    }
+    nursery_set_put(self, (uintptr_t)blk);
+    ++self->nursery_set_len;
+}
+
+static void nursery_set_remove(gc_context_t *self, const gc_nursery_block_t *blk) {
+    neo_dassert(self != NULL && blk != NULL, "Invalid arguments");
+    size_t mask = self->nursery_set_cap-1;
+    size_t i = nursery_set_slot(self, blk);
+    while (self->nursery_set[i] != (uintptr_t)blk) {
+        neo_assert(self->nursery_set[i] != 0, "Nursery block not registered: %p", blk);
+        i = (i+1)&mask;
     }
+    self->nursery_set[i] = 0;
+    for (size_t j = (i+1)&mask; self->nursery_set[j]; j = (j+1)&mask) { /* Backward shift deletion, no tombstones. */
+        size_t h = nursery_set_slot(self, self->nursery_set[j]);
+        if (((j-h)&mask) >= ((j-i)&mask)) { /* Home slot is not between the hole and j, so the entry can fill the hole. */
+            self->nursery_set[i] = self->nursery_set[j];
+            self->nursery_set[j] = 0;
+            i = j;
+        }
+    }
+    --self->nursery_set_len;
+}
+
+static gc_nursery_block_t *nursery_block_alloc(void) {
+#if defined(NEO_USE_SYSTEM_ALLOCATOR) && NEO_OS_WINDOWS
+    void *blk = _aligned_malloc(GC_NURSERY_BLOCK_SIZE, GC_NURSERY_BLOCK_SIZE);
+#elif defined(NEO_USE_SYSTEM_ALLOCATOR)
+    void *blk = NULL;
+    if (neo_unlikely(posix_memalign(&blk, GC_NURSERY_BLOCK_SIZE, GC_NURSERY_BLOCK_SIZE) != 0)) { blk = NULL; }
+#else
+    void *blk = neo_allocator_alloc_aligned(GC_NURSERY_BLOCK_SIZE, GC_NURSERY_BLOCK_SIZE);
+#endif
+    neo_assert(blk != NULL && ((uintptr_t)blk&(GC_NURSERY_BLOCK_SIZE-1)) == 0, "Nursery block allocation failed");
+    return (gc_nursery_block_t *)blk;
+}
+
+static void nursery_block_free(gc_nursery_block_t *blk) {
+#if defined(NEO_USE_SYSTEM_ALLOCATOR) && NEO_OS_WINDOWS
+    _aligned_free(blk);
+#elif defined(NEO_USE_SYSTEM_ALLOCATOR)
+    free(blk);
+#else
+    neo_allocator_free(blk);
+#endif
+}
+
+/* Unlink empty block and cache or free it. */
+static void nursery_recycle_unlink(gc_context_t *self, gc_nursery_block_t *blk) {
+    neo_dassert(self != NULL && blk != NULL && blk->recyclable, "Invalid arguments");
+    if (blk->rprev) { blk->rprev->rnext = blk->rnext; }
+    else { self->nursery_recycle = blk->rnext; }
+    if (blk->rnext) { blk->rnext->rprev = blk->rprev; }
+    blk->rprev = blk->rnext = NULL;
+    blk->recyclable = false;
+}
+
+static void nursery_block_release(gc_context_t *self, gc_nursery_block_t *blk) {
+    neo_dassert(self != NULL && blk != NULL, "Invalid arguments");
+    if (blk->recyclable) { nursery_recycle_unlink(self, blk); }
+    if (blk->prev) { blk->prev->next = blk->next; }
+    else { self->nursery_blocks = blk->next; }
+    if (blk->next) { blk->next->prev = blk->prev; }
+    --self->nursery_block_len;
+    if (self->nursery_spare_len < GC_NURSERY_SPARE_MAX) {
+        blk->next = self->nursery_spare;
+        self->nursery_spare = blk;
+        ++self->nursery_spare_len;
+    } else {
+        nursery_set_remove(self, blk);
+        nursery_block_free(blk);
+    }
+}
+
+/* Bump allocate inside the next run of free lines of the current (recycled) block. Returns false if the block has no more holes. */
+static bool nursery_next_hole(gc_context_t *self) {
+    neo_dassert(self != NULL && self->nursery != NULL, "Invalid arguments");
+    gc_nursery_block_t *blk = self->nursery;
+    size_t l = self->nursery_line;
+    while (l < GC_NURSERY_LINES && bitmap_test(blk->lines, l)) { ++l; }
+    if (l == GC_NURSERY_LINES) { return false; }
+    size_t e = l;
+    while (e < GC_NURSERY_LINES && !bitmap_test(blk->lines, e)) { ++e; }
+    self->nursery_line = e;
+    self->bump_top = (uint8_t *)blk+l*GC_NURSERY_LINE_SIZE;
+    self->bump_end = (uint8_t *)blk+e*GC_NURSERY_LINE_SIZE;
+    memset(self->bump_top, 0, (size_t)(self->bump_end-self->bump_top)); /* Holes contain dead objects. */
+    return true;
+}
+
+/*
+** Retire the current block and continue bump allocating inside the holes of a recycled block, or inside a fresh block.
+** Reusing holes of sparse blocks limits fragmentation without moving objects, conservative references can't be updated.
+*/
+static NEO_NOINLINE void nursery_refill(gc_context_t *self, size_t len) {
+    neo_dassert(self != NULL, "self is NULL");
+    for (;;) {
+        if (self->nursery_recycling) {
+            while (nursery_next_hole(self)) {
+                if ((size_t)(self->bump_end-self->bump_top) >= len) { return; }
+            }
+        }
+        gc_nursery_block_t *blk = self->nursery;
+        self->nursery = NULL;
+        self->nursery_recycling = false;
+        if (blk && !blk->live) { nursery_block_release(self, blk); } /* All objects of the retired block already died. */
+        if (!self->nursery_recycle) { break; }
+        blk = self->nursery_recycle;
+        nursery_recycle_unlink(self, blk);
+        self->nursery = blk;
+        self->nursery_recycling = true;
+        self->nursery_line = GC_NURSERY_HEADER_LINES;
+        self->bump_top = self->bump_end = NULL;
+    }
+    gc_nursery_block_t *blk;
+    if (self->nursery_spare) {
+        blk = self->nursery_spare;
+        self->nursery_spare = blk->next;
+        --self->nursery_spare_len;
+    } else {
+        blk = nursery_block_alloc();
+        nursery_set_insert(self, blk);
+    }
+    memset(blk, 0, GC_NURSERY_BLOCK_SIZE); /* Zero whole block (and the side bitmaps) once instead of each object. */
+    blk->next = self->nursery_blocks;
+    if (blk->next) { blk->next->prev = blk; }
+    self->nursery_blocks = blk;
+    ++self->nursery_block_len;
+    self->nursery = blk;
+    self->bump_top = (uint8_t *)blk+GC_NURSERY_HEADER;
+    self->bump_end = (uint8_t *)blk+GC_NURSERY_BLOCK_SIZE;
+}
+
+/* Mark lines covered by a surviving nursery object. */
+static NEO_AINLINE void nursery_mark_lines(const void *ptr, gc_grasize_t size) {
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    size_t off = (size_t)((uintptr_t)ptr-(uintptr_t)blk);
+    size_t last = (off+gc_granules2bytes(size)-1)/GC_NURSERY_LINE_SIZE;
+    for (size_t l = off/GC_NURSERY_LINE_SIZE; l <= last; ++l) { bitmap_set(blk->lines, l); }
+}
+
+/* Rebuild the recycle list from all blocks with enough free lines. */
+static void nursery_rebuild_recycle(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    for (gc_nursery_block_t *blk = self->nursery_blocks; blk; blk = blk->next) {
+        if (blk == self->nursery || blk->recyclable || !blk->live) { continue; }
+        size_t used = 0;
+        for (size_t i = 0; i < sizeof(blk->lines)/sizeof(*blk->lines); ++i) {
+            for (uint64_t w = blk->lines[i]; w; w &= w-1) { ++used; }
+        }
+        if (GC_NURSERY_LINES-used < GC_NURSERY_RECYCLE_MIN) { continue; } /* Too dense, not worth it. */
+        blk->recyclable = true;
+        blk->rprev = NULL;
+        blk->rnext = self->nursery_recycle;
+        if (blk->rnext) { blk->rnext->rprev = blk; }
+        self->nursery_recycle = blk;
+    }
+}
+
+/* Bump allocate object of <len> bytes and its header. The header is written by the caller. */
+static NEO_AINLINE void *nursery_alloc(gc_context_t *self, size_t len) {
+    neo_dassert(self != NULL, "self is NULL");
+    len += sizeof(gc_nursery_hdr_t);
+    if (neo_unlikely((size_t)(self->bump_end-self->bump_top) < len)) { nursery_refill(self, len); }
+    void *ptr = self->bump_top+sizeof(gc_nursery_hdr_t);
+    self->bump_top += len;
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    ++blk->live;
+    bitmap_set(blk->starts, gc_nursery_granule(blk, ptr));
+    return ptr;
+}
+
+static void nursery_free(gc_context_t *self, void *ptr) {
+    neo_dassert(self != NULL && ptr != NULL, "Invalid arguments");
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    neo_assert(blk->live != 0, "Nursery block live count underflow");
+    bitmap_clear(blk->starts, gc_nursery_granule(blk, ptr)); /* Dangling references must not identify the dead object. */
+    if (!--blk->live && blk != self->nursery) { /* The current block is retired by nursery_refill. */
+        nursery_block_release(self, blk);
+    }
+}
+
+#define GCF__PINNED (GCF_ROOT|GCF_QUEUED) /* Flags which make an object a root of the marker. */
+
+/* Header of the nursery object, which starts at <ptr>. NULL if <ptr> is not the start of a live nursery object. */
+static NEO_AINLINE gc_nursery_hdr_t *nursery_hdr(const gc_context_t *self, const void *ptr) {
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    if (((uintptr_t)ptr&(GC_ALLOC_GRANULARITY-1)) || !nursery_set_contains(self, blk)) { return NULL; }
+    return bitmap_test(blk->starts, gc_nursery_granule(blk, ptr)) ? gc_nursery_hdr_of(ptr) : NULL;
+}
+
+#define GCF__SIDE (GCF_LEAF|GCF_OLD) /* Flags of nursery objects, which are kept in side bitmaps instead of the header. */
+
+/* GCF_LEAF and GCF_OLD of the nursery object at granule <g> of its block. */
+static NEO_AINLINE gc_flags_t nursery_side_flags(const gc_nursery_block_t *blk, size_t g) {
+    return (gc_flags_t)((bitmap_test(blk->leafs, g) ? GCF_LEAF : 0)|(bitmap_test(blk->olds, g) ? GCF_OLD : 0));
+}
+
+static NEO_AINLINE gc_flags_t nursery_flags(const void *ptr) {
+    const gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    return (gc_flags_t)(gc_nursery_hdr_of(ptr)->flags|nursery_side_flags(blk, gc_nursery_granule(blk, ptr)));
+}
+
+/* Set flags of a nursery object. Pinned objects are counted, because the marker has to find them by walking the blocks. */
+static void nursery_set_flags(gc_context_t *self, void *ptr, gc_flags_t flags) {
+    gc_nursery_hdr_t *h = gc_nursery_hdr_of(ptr);
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    size_t g = gc_nursery_granule(blk, ptr);
+    if ((h->flags & GCF__PINNED) && !(flags & GCF__PINNED)) { --self->nursery_pinned; }
+    else if (!(h->flags & GCF__PINNED) && (flags & GCF__PINNED)) { ++self->nursery_pinned; }
+    if (flags & GCF_LEAF) { bitmap_set(blk->leafs, g); } else { bitmap_clear(blk->leafs, g); }
+    if (flags & GCF_OLD) { bitmap_set(blk->olds, g); } else { bitmap_clear(blk->olds, g); }
+    h->flags = (gc_flags_t)(flags&(~GCF__SIDE&255));
+}
+
+/* Descriptor of a nursery object in the form of a table entry. Changes to it are not written back, see obj_set_flags. */
+static NEO_AINLINE gc_fatptr_t nursery_view(void *ptr) {
+    const gc_nursery_hdr_t *h = gc_nursery_hdr_of(ptr);
+    gc_fatptr_t p = {.ptr = ptr, .grasize = h->grasize, .flags = nursery_flags(ptr), .oid = h->oid, .hash = 0, .span = 0};
+    return p;
+}
+
+/* Visit each nursery object of a block, whose granule is set in the side bitmap <map> (starts or marks). */
+#define nursery_foreach(blk, map, ptr) \
+    bitmap_foreach((blk)->map, GC_NURSERY_BITMAP_LEN, ptr##_g) \
+        for (void *ptr = (uint8_t *)(blk)+gc_granules2bytes(ptr##_g); ptr; ptr = NULL)
+
+/* Resolve any object: Its table or large object entry, or the view of its nursery header, which is stored in <tmp>. */
+static NEO_AINLINE gc_fatptr_t *resolve_obj(gc_context_t *self, const void *ptr, gc_fatptr_t *tmp) {
+    neo_dassert(self != NULL && tmp != NULL, "Invalid arguments");
+    if (nursery_hdr(self, ptr)) {
+        *tmp = nursery_view((void *)ptr);
+        return tmp;
+    }
+    return resolve_ptr(self, ptr);
+}
+
+/* Set flags of a resolved object, nursery views are written back to the header. */
+static void obj_set_flags(gc_context_t *self, gc_fatptr_t *p, gc_flags_t flags) {
+    neo_dassert(self != NULL && p != NULL, "Invalid arguments");
+    if (p->flags & GCF_NURSERY) { nursery_set_flags(self, p->ptr, flags); }
+    p->flags = flags;
+}
+
+/* ---- Large object space ---- */
+
+#define GC_SPAN_PURGE_ZEROES NEO_OS_LINUX /* Purged private anonymous pages read as zero on Linux, elsewhere reused spans are cleared. */
+
+static void *span_map(size_t len) {
+#if NEO_OS_WINDOWS
+    void *p = VirtualAlloc(NULL, len, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    p = p == MAP_FAILED ? NULL : p;
+#endif
+    neo_assert(p != NULL, "Failed to map large object span: %zub", len);
+    return p;
+}
+
+static void span_unmap(void *p, size_t len) {
+#if NEO_OS_WINDOWS
+    (void)len;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, len);
+#endif
+}
+
+/* Return the physical pages of the span to the OS, the address range stays reserved. */
+static void span_purge(void *p, size_t len) {
+#if NEO_OS_WINDOWS
+    VirtualAlloc(p, len, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(p, len, MADV_DONTNEED);
+#endif
+}
+
+/* Allocate zeroed, page aligned span of at least <bytes>. A cached span is reused if it wastes at most 25%. */
+static void *large_alloc(gc_context_t *self, size_t bytes, size_t *len) {
+    neo_dassert(self != NULL && len != NULL, "Invalid arguments");
+    size_t need = (bytes+self->page_size-1)&~(self->page_size-1);
+    size_t best = SIZE_MAX;
+    for (size_t i = 0; i < self->large_spare_len; ++i) {
+        size_t n = self->large_spare[i].len;
+        if (n >= need && n-need <= need>>2 && (best == SIZE_MAX || n < self->large_spare[best].len)) { best = i; }
+    }
+    if (best == SIZE_MAX) {
+        *len = need;
+        void *p = span_map(need);
+        if (self->mempolicy) { neo_osi_mem_policy(p, need, self->mempolicy, self->numa_node); } /* Before the first touch. */
+        return p;
+    }
+    gc_span_t span = self->large_spare[best];
+    self->large_spare[best] = self->large_spare[--self->large_spare_len];
+#if !GC_SPAN_PURGE_ZEROES
+    memset(span.base, 0, bytes);
+#endif
+    *len = span.len;
+    return span.base;
+}
+
+static void large_release(gc_context_t *self, void *ptr, size_t len) {
+    neo_dassert(self != NULL && ptr != NULL, "Invalid arguments");
+    if (self->large_spare_len == GC_LARGE_SPARE_MAX) {
+        span_unmap(ptr, len);
+        return;
+    }
+    span_purge(ptr, len);
+    self->large_spare[self->large_spare_len++] = (gc_span_t){.base = ptr, .len = len};
+}
+
+/* Insert large object, sorted by address. */
+static void large_insert(gc_context_t *self, const gc_fatptr_t *item) {
+    neo_dassert(self != NULL && item != NULL, "Invalid arguments");
+    if (self->large_len == self->large_cap) {
+        self->large_cap = self->large_cap ? self->large_cap<<1 : 1<<4;
+        self->large = neo_memalloc(self->large, self->large_cap*sizeof(*self->large));
+    }
+    size_t lo = 0, hi = self->large_len;
+    while (lo < hi) {
+        size_t mid = lo+((hi-lo)>>1);
+        if ((uintptr_t)self->large[mid].ptr < (uintptr_t)item->ptr) { lo = mid+1; }
+        else { hi = mid; }
+    }
+    memmove(self->large+lo+1, self->large+lo, (self->large_len-lo)*sizeof(*self->large));
+    self->large[lo] = *item;
+    ++self->large_len;
+}
+
+static void large_remove(gc_context_t *self, void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_fatptr_t *p = large_find(self, ptr);
+    if (!p) { return; }
+    size_t i = (size_t)(p-self->large);
+    memmove(self->large+i, self->large+i+1, (self->large_len-i-1)*sizeof(*self->large));
+    --self->large_len;
+}
+
+/* ---- Allocation profiler ---- */
+
+struct gc_prof_obj_t { /* Sampled object, which is still alive. */
+    const void *ptr; /* NULL if the slot is empty. */
+    size_t site; /* Index into gc_context_t.prof_sites. */
+    size_t objects; /* Weight of the sample. */
+    size_t bytes;
+};
+
+#define prof_hash(k, mask) ((size_t)(((uint64_t)(k)*UINT64_C(0x9e3779b97f4a7c15))>>32)&(mask))
+
+/* Distance to the next sample in bytes, drawn from an exponential distribution with mean <prof_interval>. */
+static size_t prof_next(gc_context_t *self) {
+    uint64_t x = self->prof_rng; /* xorshift64* */
+    x ^= x>>12; x ^= x<<25; x ^= x>>27;
+    self->prof_rng = x;
+    x *= UINT64_C(0x2545f4914f6cdd1d); /* Scramble output, small states would yield tiny numbers. */
+    double u = (double)((x>>11)+1)*0x1.0p-53; /* (0, 1] */
+    return 1+(size_t)(-log(u)*(double)self->prof_interval);
+}
+
+static size_t prof_site_index(gc_context_t *self, uintptr_t site) {
+    if (self->prof_sites_len<<1 >= self->prof_index_cap) { /* Grow and rebuild index. */
+        self->prof_index_cap = self->prof_index_cap ? self->prof_index_cap<<1 : 1<<6;
+        neo_memalloc(self->prof_index, 0);
+        self->prof_index = neo_memalloc(NULL, self->prof_index_cap*sizeof(*self->prof_index));
+        memset(self->prof_index, 0, self->prof_index_cap*sizeof(*self->prof_index));
+        for (size_t i = 0; i < self->prof_sites_len; ++i) {
+            size_t j = prof_hash(self->prof_sites[i].site, self->prof_index_cap-1);
+            while (self->prof_index[j]) { j = (j+1)&(self->prof_index_cap-1); }
+            self->prof_index[j] = (uint32_t)(i+1);
+        }
+    }
+    size_t j = prof_hash(site, self->prof_index_cap-1);
+    for (; self->prof_index[j]; j = (j+1)&(self->prof_index_cap-1)) {
+        if (self->prof_sites[self->prof_index[j]-1].site == site) { return self->prof_index[j]-1; }
+    }
+    neo_assert(self->prof_sites_len < UINT32_MAX, "Too many allocation sites");
+    if (self->prof_sites_len == self->prof_sites_cap) {
+        self->prof_sites_cap = self->prof_sites_cap ? self->prof_sites_cap<<1 : 1<<5;
+        self->prof_sites = neo_memalloc(self->prof_sites, self->prof_sites_cap*sizeof(*self->prof_sites));
+    }
+    memset(self->prof_sites+self->prof_sites_len, 0, sizeof(*self->prof_sites));
+    self->prof_sites[self->prof_sites_len].site = site;
+    self->prof_index[j] = (uint32_t)++self->prof_sites_len;
+    return self->prof_sites_len-1;
+}
+
+static void prof_obj_insert(gc_context_t *self, const struct gc_prof_obj_t *obj) {
+    if (self->prof_objs_len<<1 >= self->prof_objs_cap) { /* Keep the load factor <= 50%, probe sequences stay short. */
+        struct gc_prof_obj_t *old = self->prof_objs;
+        size_t old_cap = self->prof_objs_cap;
+        self->prof_objs_cap = old_cap ? old_cap<<1 : 1<<6;
+        self->prof_objs = neo_memalloc(NULL, self->prof_objs_cap*sizeof(*self->prof_objs));
+        memset(self->prof_objs, 0, self->prof_objs_cap*sizeof(*self->prof_objs));
+        self->prof_objs_len = 0;
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i].ptr) { prof_obj_insert(self, old+i); }
+        }
+        neo_memalloc(old, 0);
+    }
+    size_t mask = self->prof_objs_cap-1;
+    size_t i = prof_hash(gc_hash(obj->ptr), mask);
+    while (self->prof_objs[i].ptr && self->prof_objs[i].ptr != obj->ptr) { i = (i+1)&mask; }
+    if (!self->prof_objs[i].ptr) { ++self->prof_objs_len; }
+    self->prof_objs[i] = *obj;
+}
+
+/* Sample allocation of <bytes> at <ptr>. */
+static NEO_NOINLINE void prof_sample(gc_context_t *self, const void *ptr, size_t bytes) {
+    self->prof_countdown = prof_next(self);
+    double p = 1.0-exp(-(double)bytes/(double)self->prof_interval); /* Probability that this allocation was sampled. */
+    struct gc_prof_obj_t obj = {
+        .ptr = ptr,
+        .site = prof_site_index(self, self->prof_site),
+        .objects = (size_t)(1.0/p+0.5),
+        .bytes = (size_t)((double)bytes/p+0.5)
+    };
+    gc_prof_site_t *site = self->prof_sites+obj.site;
+    ++site->samples;
+    site->objects += obj.objects;
+    site->bytes += obj.bytes;
+    site->live_objects += obj.objects;
+    site->live_bytes += obj.bytes;
+    prof_obj_insert(self, &obj);
+}
+
+static NEO_AINLINE void prof_alloc(gc_context_t *self, const void *ptr, size_t bytes) {
+    if (neo_unlikely(!self->prof_countdown)) { self->prof_countdown = prof_next(self); } /* First allocation since profiling was enabled. */
+    if (neo_likely(bytes < self->prof_countdown)) { self->prof_countdown -= bytes; }
+    else { prof_sample(self, ptr, bytes); }
+}
+
+/* Object is released: Remove it from the live samples. */
+static void prof_release(gc_context_t *self, const void *ptr) {
+    size_t mask = self->prof_objs_cap-1;
+    size_t i = prof_hash(gc_hash(ptr), mask);
+    for (; self->prof_objs[i].ptr != ptr; i = (i+1)&mask) {
+        if (!self->prof_objs[i].ptr) { return; } /* Not sampled. */
+    }
+    gc_prof_site_t *site = self->prof_sites+self->prof_objs[i].site;
+    site->live_objects -= self->prof_objs[i].objects;
+    site->live_bytes -= self->prof_objs[i].bytes;
+    --self->prof_objs_len;
+    for (size_t j = (i+1)&mask; self->prof_objs[j].ptr; j = (j+1)&mask) { /* Backward shift deletion, no tombstones. */
+        size_t k = prof_hash(gc_hash(self->prof_objs[j].ptr), mask);
+        if (((j-k)&mask) >= ((j-i)&mask)) { /* Entry j may move into the hole at i. */
+            self->prof_objs[i] = self->prof_objs[j];
+            i = j;
+        }
+    }
+    self->prof_objs[i].ptr = NULL;
+}
+
+/* Allocate memory of an individual object from the private heap. */
+static void *obj_memalloc(gc_context_t *self, size_t len) {
+#ifdef NEO_USE_SYSTEM_ALLOCATOR
+    (void)self;
+    return neo_memalloc(NULL, len);
+#else
+    void *p = neo_allocator_heap_alloc(self->heap, len);
+    neo_assert(p != NULL, "Memory allocation of %zub failed", len);
+    return p;
+#endif
+}
+
+/* Free object memory, nursery objects are owned by their block. */
+static void release_obj(gc_context_t *self, const gc_fatptr_t *p) {
+    neo_dassert(self != NULL && p != NULL, "Invalid arguments");
+    if (self->dtor_hook && !(p->flags & GCF_FINALIZED)) { (*self->dtor_hook)(p->ptr); }
+    if (neo_unlikely(self->prof_objs_len)) { prof_release(self, p->ptr); }
+    if (p->flags & GCF_NURSERY) { nursery_free(self, p->ptr); }
+    else if (p->span) { large_release(self, p->ptr, (size_t)p->span*self->page_size); }
+    else { neo_memalloc(p->ptr, 0); } /* Free individual allocation, frees from other threads are deferred to the heap owner. */
+}
+
+static size_t gc_ideal_size(const gc_context_t* self, size_t size) {
+    neo_dassert(self != NULL, "self is NULL");
+    size = (size_t)((double)(size+1)/self->loadfactor);
+    size_t slots = GC_MIN_SLOTS;
+    while (slots < size) { slots <<= 1; } /* Power of two, so slots are computed by masking instead of a division. */
+    return slots;
 }
 
 static void rehash_alloc_map(gc_context_t* self, size_t new_size) {
     neo_dassert(self != NULL, "self is NULL");
     gc_fatptr_t *old_items = self->trackedallocs;
     size_t old_size = self->slots;
+    neo_assert(new_size >= GC_MIN_SLOTS && (new_size&(new_size-1)) == 0, "Table size must be a power of two: %zu", new_size);
     self->slots = new_size;
+    self->slot_shift = 64;
+    for (size_t n = new_size; n > 1; n >>= 1) { --self->slot_shift; } /* 64 - log2(slots), Fibonacci hashing keeps the high bits. */
     self->trackedallocs = neo_memalloc(NULL, self->slots*sizeof(gc_fatptr_t));
+    memset(self->trackedallocs, 0, self->slots*sizeof(gc_fatptr_t)); /* Empty slots have hash 0, the allocator doesn't guarantee zeroed memory. */
     for (size_t i = 0; i < old_size; ++i) {
         if (neo_likely(old_items[i].hash)) {
-            attach_ptr(self, old_items[i].ptr, old_items[i].grasize, old_items[i].flags);
+            attach_ptr(self, old_items[i].ptr, old_items[i].grasize, old_items[i].flags, old_items[i].oid);
         }
     }
     neo_memalloc(old_items, 0);
@@ -134,43 +732,148 @@ static void rehash_alloc_map(gc_context_t* self, size_t new_size) {
 
 static void grow_alloc_map(gc_context_t *self) {
     neo_dassert(self != NULL, "self is NULL");
-    size_t new_size = gc_ideal_size(self, self->alloc_len);
+    size_t new_size = gc_ideal_size(self, self->table_len);
     size_t old_size = self->slots;
     if (new_size > old_size) { rehash_alloc_map(self, new_size); }
 }
 
 static void shrink_alloc_map(gc_context_t *self) {
     neo_dassert(self != NULL, "self is NULL");
-    size_t new_size = gc_ideal_size(self, self->alloc_len);
+    size_t new_size = gc_ideal_size(self, self->table_len);
     size_t old_size = self->slots;
     if (new_size < old_size) { rehash_alloc_map(self, new_size); }
 }
 
-/* Traces and marks all life objects. */
-static NEO_HOTPROC void gc_mark_ptr(gc_context_t *self, const void *ptr) {
+/* Is the tracked nursery object marked? Nursery mark bits live in the side bitmap of the block. */
+static NEO_AINLINE bool nursery_marked(const void *ptr) {
+    const gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    return bitmap_test(blk->marks, gc_nursery_granule(blk, ptr)) != 0;
+}
+
+/* Mark tracked object, returns false if it was already marked. */
+static NEO_AINLINE bool mark_obj(gc_fatptr_t *p) {
+    if (p->flags & GCF_NURSERY) {
+        gc_nursery_block_t *blk = gc_nursery_block_of(p->ptr);
+        size_t g = gc_nursery_granule(blk, p->ptr);
+        if (bitmap_test(blk->marks, g)) { return false; }
+        bitmap_set(blk->marks, g);
+        return true;
+    }
+    if (p->flags & GCF_MARK) { return false; }
+    p->flags |= GCF_MARK;
+    return true;
+}
+
+/* Is the tracked object marked? */
+static NEO_AINLINE bool obj_marked(const gc_fatptr_t *p) {
+    return (p->flags & GCF_NURSERY) ? nursery_marked(p->ptr) : (p->flags & GCF_MARK) != 0;
+}
+
+/*
+** Push marked object onto the mark stack (grey worklist), its children are scanned when it's popped.
+** The stack grows up to gc_context_t.mark_stack_max entries. If it overflows, the object stays marked but unscanned
+** and the overflow flag is set, so the heap is rescanned for marked objects once the stack is drained.
+*/
+static void grey_push(gc_context_t *self, const void *ptr) {
     neo_dassert(self != NULL, "self is NULL");
-    size_t i, j, h;
-    if (neo_unlikely((uintptr_t)ptr < self->bndmin || (uintptr_t)ptr > self->bndmax)) { return; } /* Out of bounds. */
-    i = gc_hash(ptr) % self->slots; j = 0;
-    for (;;) {
-        h = self->trackedallocs[i].hash;
-        if (h == 0 || j > probe_dist(self, i, h)) { return; }
-        if (ptr == self->trackedallocs[i].ptr) {
-            if (self->trackedallocs[i].flags & GCF_MARK) { return; } /* Already marked. */
-            self->trackedallocs[i].flags |= GCF_MARK; /* Mark object. */
-            if (self->trackedallocs[i].flags & GCF_LEAF) { return; } /* Leaf object, child-scanning is redundant. */
-            scan_region(self, self->trackedallocs[i].ptr, ptrsize(self->trackedallocs[i])); /* Scan child nodes. */
+    if (neo_unlikely(self->grey_len == self->grey_cap)) {
+        if (self->grey_cap >= self->mark_stack_max) {
+            self->mark_overflow = true;
             return;
         }
-        i = (i+1) % self->slots; ++j;
+        self->grey_cap = self->grey_cap ? self->grey_cap<<1 : 1<<8;
+        self->grey_cap = self->grey_cap > self->mark_stack_max ? self->mark_stack_max : self->grey_cap;
+        self->grey = neo_memalloc(self->grey, self->grey_cap*sizeof(*self->grey));
+    }
+    self->grey[self->grey_len++] = ptr;
+}
+
+#define scan_obj(self, p) grey_push((self), (p)->ptr) /* Children are scanned by gc_mark_drain, marking never recurses. */
+
+/*
+** Traces and marks all life objects.
+** Candidates inside nursery blocks are identified by a block set lookup and a start bitmap test, and marked in the side bitmap.
+** Nursery objects are not inside the table, whether they must be scanned is decided by the leaf and old side bitmaps of the block.
+*/
+static NEO_HOTPROC void gc_mark_ptr(gc_context_t *self, const void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    if (neo_unlikely((uintptr_t)ptr < self->bndmin || (uintptr_t)ptr > self->bndmax)) { return; } /* Out of bounds. */
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    if (nursery_set_contains(self, blk)) {
+        size_t g = gc_nursery_granule(blk, ptr);
+        if (((uintptr_t)ptr&(GC_ALLOC_GRANULARITY-1)) || !bitmap_test(blk->starts, g)) { return; } /* Interior pointer, header or free memory. */
+        if (bitmap_test(blk->marks, g)) { return; } /* Already marked. */
+        bitmap_set(blk->marks, g); /* Mark object. */
+        if (nursery_side_flags(blk, g) & (self->minor ? GCF_LEAF|GCF_OLD : GCF_LEAF)) { return; } /* Leaf object or old object during a minor collection (sticky mark bits). */
+        grey_push(self, ptr); /* Scan child nodes. */
+        return;
     }
+    gc_fatptr_t *p = neo_likely(self->slots) ? lookup_ptr_probes(self, ptr, &self->probes) : NULL;
+    if (!p && large_candidate(self, ptr)) { p = large_find(self, ptr); }
+    if (!p) { return; } /* Not an object. */
+    if (p->flags & (self->minor ? GCF_MARK|GCF_OLD : GCF_MARK)) { return; } /* Already marked or old. */
+    p->flags |= GCF_MARK; /* Mark object. */
+    if (p->flags & GCF_LEAF) { return; } /* Leaf object, child-scanning is redundant. */
+    scan_obj(self, p); /* Scan child nodes. */
+}
+
+/* ---- Layouts ---- */
+
+/*
+** Object layouts, registered by gc_layout_register. The object ID (gc_fatptr_t.oid) is the layout index + 1.
+** Bit i of the reference map is set if granule i holds a reference, all other granules are never scanned.
+** If the object is larger than the layout, the layout repeats (arrays of records).
+*/
+typedef struct gc_layout_t gc_layout_t;
+struct gc_layout_t {
+    gc_grasize_t len; /* Number of granules of the layout. */
+    gc_grasize_t refs; /* Number of reference slots. If 0, objects with this layout are leafs. */
+    uint64_t *refmap; /* Reference bitmap, one bit per granule. */
+};
+#define GC_OID_MAX ((1u<<24)-1) /* Max object layout ID, gc_fatptr_t.oid is a 24-bit field. */
+
+/* Visit index <i> of each reference slot inside an object of <size> granules. */
+#define layout_foreach_ref(l, size, i) \
+    for (size_t i##_base = 0; i##_base < (size); i##_base += (l)->len) \
+        for (size_t i##_j = 0, i = i##_base; i##_j < (l)->len && i < (size); ++i##_j, ++i) \
+            if (bitmap_test((l)->refmap, i##_j))
+
+/* Scan child nodes of an object: Precisely if the object has a layout, else conservatively. */
+static NEO_AINLINE void scan_children(gc_context_t *self, const gc_fatptr_t *p) {
+    neo_dassert(self != NULL && p != NULL, "Invalid arguments");
+    const void **slots = (const void **)p->ptr;
+    size_t size = ptrsize(*p);
+    uint32_t oid = p->oid;
+    if (!oid) { scan_region(self, slots, size); return; }
+    neo_dassert(oid <= self->layout_len, "Invalid object layout ID: %"PRIu32, oid);
+    const gc_layout_t *l = self->layouts+(oid-1);
+    layout_foreach_ref(l, size, i) { gc_mark_ptr(self, gc_load_ref(slots+i)); }
+}
 
+/* Mark root or finalizable object and scan its children. */
+static NEO_AINLINE void mark_root(gc_context_t *self, gc_fatptr_t *p) {
+    if (!(p->flags & GCF__PINNED)) { return; }
+    if (!mark_obj(p)) { return; } /* Already marked. */
+    if (p->flags & GCF_LEAF) { return; } /* Leaf object, child-scanning is redundant. */
+    scan_obj(self, p); /* Scan child nodes. */
+}
+
+/* Number of stack slots to scan. Only the live region [stk, stk_top] is scanned if the top is known. */
+static size_t gc_stack_len(const gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    size_t len = self->stk_spdelta;
+    if (self->stk_top) {
+        neo_assert((uintptr_t)self->stk_top >= (uintptr_t)self->stk, "Stack top below stack bottom");
+        size_t live = (size_t)((const void **)self->stk_top-(const void **)self->stk)+1; /* +1 Because the top element is inclusive. */
+        len = live < len ? live : len;
+    }
+    return len;
 }
 
 /* Mark life root objects and their child nodes on the stack. */
 static void gc_mark_stack(gc_context_t *self) {
     neo_dassert(self != NULL, "self is NULL");
-    scan_region(self, self->stk, self->stk_spdelta); /* +1 Because the end iterator must be one address after the last element. */
+    scan_region(self, self->stk, gc_stack_len(self));
 }
 
 /*
@@ -184,41 +887,647 @@ static NEO_HOTPROC void gc_mark(gc_context_t *self) {
     /* 1. Mark all root objects. */
     for (size_t i = 0; i < self->slots; ++i) {
         if (neo_unlikely(!self->trackedallocs[i].hash)) { continue; }
-        if (self->trackedallocs[i].flags & GCF_MARK) { continue; } /* Already marked. */
-        if (self->trackedallocs[i].flags & GCF_ROOT) { /* Root object, scan children. */
-            self->trackedallocs[i].flags |= GCF_MARK; /* Mark object. */
-            if (self->trackedallocs[i].flags & GCF_LEAF) { continue; } /* Leaf object, child-scanning is redundant. */
-            scan_region(self, self->trackedallocs[i].ptr, ptrsize(self->trackedallocs[i])); /* Scan child nodes. */
-            continue;
+        mark_root(self, self->trackedallocs+i);
+    }
+    for (size_t i = 0; i < self->large_len; ++i) {
+        mark_root(self, self->large+i);
+    }
+    if (self->nursery_pinned) { /* Pinned nursery objects are only found by walking the blocks, which is skipped if there are none. */
+        for (gc_nursery_block_t *blk = self->nursery_blocks; blk; blk = blk->next) {
+            nursery_foreach(blk, starts, ptr) {
+                if (!(nursery_flags(ptr) & GCF__PINNED)) { continue; }
+                gc_fatptr_t view = nursery_view(ptr);
+                mark_root(self, &view);
+            }
+        }
+    }
+    /* 2. Minor collection: Old objects in the remembered set might reference young objects. */
+    if (self->minor) {
+        gc_fatptr_t tmp;
+        for (size_t i = 0; i < self->remset_len; ++i) {
+            const gc_fatptr_t *p = resolve_obj(self, self->remset[i], &tmp);
+            if (!p || (p->flags & GCF_LEAF)) { continue; } /* Freed in the meantime or leaf. */
+            scan_children(self, p); /* Scan child nodes. */
         }
     }
-    /* 2. Mark all stack objects. */
+    /* 3. Mark all stack objects. */
     gc_mark_stack(self);
 }
 
+/* Pop grey object and scan its children. */
+static NEO_AINLINE void grey_pop_scan(gc_context_t *self) {
+    neo_dassert(self != NULL && self->grey_len, "Invalid arguments");
+    const void *ptr = self->grey[--self->grey_len];
+    gc_fatptr_t tmp;
+    const gc_fatptr_t *p = resolve_obj(self, ptr, &tmp); /* Resolve again, the object might have been freed after it was pushed. */
+    if (p) { scan_children(self, p); }
+}
+
+/* Mark stack overflowed: Scan all marked objects again, which pushes their unmarked children. */
+static NEO_NOINLINE void gc_mark_rescan(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    gctrace("Mark stack overflow, rescanning heap");
+    self->mark_overflow = false;
+    for (size_t i = 0; i < self->slots; ++i) {
+        const gc_fatptr_t *p = self->trackedallocs+i;
+        if (!p->hash || (p->flags & GCF_LEAF) || !obj_marked(p)) { continue; }
+        scan_children(self, p);
+    }
+    for (size_t i = 0; i < self->large_len; ++i) {
+        const gc_fatptr_t *p = self->large+i;
+        if ((p->flags & GCF_LEAF) || !obj_marked(p)) { continue; }
+        scan_children(self, p);
+    }
+    for (gc_nursery_block_t *blk = self->nursery_blocks; blk; blk = blk->next) {
+        nursery_foreach(blk, marks, ptr) {
+            if (bitmap_test(blk->leafs, ptr_g)) { continue; }
+            gc_fatptr_t view = nursery_view(ptr);
+            scan_children(self, &view);
+        }
+    }
+}
+
+/*
+** Scan grey objects until the mark stack is empty (returns true) or the deadline is reached (returns false).
+** Popped objects pass through a small FIFO, so their memory is prefetched a few objects before it's scanned.
+*/
+static bool gc_mark_drain(gc_context_t *self, uint64_t deadline) {
+    neo_dassert(self != NULL, "self is NULL");
+    const void *fifo[GC_MARK_PREFETCH];
+    size_t head = 0, len = 0, n = 0;
+    for (;;) {
+        while (len < GC_MARK_PREFETCH && self->grey_len) {
+            const void *ptr = self->grey[--self->grey_len];
+            gc_prefetch(ptr);
+            fifo[(head+len++)&(GC_MARK_PREFETCH-1)] = ptr;
+        }
+        if (!len) {
+            if (!self->mark_overflow) { return true; }
+            gc_mark_rescan(self);
+            continue;
+        }
+        const void *ptr = fifo[head];
+        head = (head+1)&(GC_MARK_PREFETCH-1);
+        --len;
+        gc_fatptr_t tmp;
+        const gc_fatptr_t *p = resolve_obj(self, ptr, &tmp); /* Resolve again, the object might have been freed after it was pushed. */
+        if (p) { scan_children(self, p); }
+        if (!(++n&(GC_STEP_CLOCK_INTERVAL-1)) && neo_hp_clock_us() >= deadline) {
+            while (len--) { /* Return prefetched objects to the mark stack. */
+                grey_push(self, fifo[head]);
+                head = (head+1)&(GC_MARK_PREFETCH-1);
+            }
+            return false;
+        }
+    }
+}
+
+static void gc_sweep(gc_context_t *self);
+
+/*
+** Final atomic pause of an incremental cycle.
+** The VM stack has no write barrier, so it is rescanned (together with new roots) and the rest is traced without budget.
+*/
+static void gc_mark_finish(gc_context_t *self) {
+    neo_dassert(self != NULL && self->phase == GC_PHASE_MARK, "No incremental cycle in progress");
+    gc_mark(self);
+    gc_mark_drain(self, UINT64_MAX);
+    self->phase = GC_PHASE_IDLE;
+    gc_sweep(self); /* Only nursery objects are released inside the pause, see sweep_pending. */
+    gctrace("Incremental cycle finished after %zu steps", self->steps);
+}
+
+/* ---- Concurrent marker ---- */
+
+/*
+** Optional background marker thread (gc_context_t.concurrent), which traces the grey worklist while the mutator runs.
+** The table, the bitmaps and the worklist are guarded by the marker lock, which the mutator takes inside all public GC functions.
+** The marker releases the lock after each batch of grey objects, so allocation and barriers are only blocked for a short time.
+** The marker scans grey objects while it holds the lock, but mutators store references into objects without taking it.
+** So scanning loads reference slots with relaxed atomic loads (gc_load_ref), and mutators store them with gc_store_ref.
+** A store might still overwrite the only path to an unscanned object, so gc_write_barrier shades the overwritten reference (snapshot at the beginning).
+** The final remark (gc_mark_finish) runs on the mutator and only rescans the roots and the live VM stack region.
+** Between cycles, the marker releases pending dead objects of the last sweep, unless a destructor hook is installed.
+*/
+static void sweep_pending(gc_context_t *self, size_t n);
+
+#if GC_CONCURRENT
+#include <pthread.h>
+#include <sched.h>
+
+struct gc_marker_t {
+    pthread_t thread;
+    pthread_mutex_t lock; /* Guards the GC context while the marker exists. */
+    pthread_cond_t wake; /* Signalled when grey objects are available or the marker must quit. */
+    bool quit;
+};
+
+static void *gc_marker_main(void *arg) {
+    gc_context_t *self = (gc_context_t *)arg;
+    struct gc_marker_t *m = self->marker;
+#ifndef NEO_USE_SYSTEM_ALLOCATOR
+    neo_allocator_thread_enter();
+#endif
+    pthread_mutex_lock(&m->lock);
+    while (!m->quit) {
+        if (self->phase == GC_PHASE_MARK && self->grey_len) {
+            for (size_t n = 0; n < GC_MARKER_BATCH && self->grey_len; ++n) {
+                grey_pop_scan(self);
+            }
+        } else if (self->free_len && (!self->dtor_hook || self->finalize_deferred)) { /* Sweep in the background, destructor hooks must run on the mutator. */
+            sweep_pending(self, GC_MARKER_BATCH);
+        } else {
+            pthread_cond_wait(&m->wake, &m->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&m->lock);
+        sched_yield(); /* Give a blocked mutator the chance to take the lock. */
+        pthread_mutex_lock(&m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+#ifndef NEO_USE_SYSTEM_ALLOCATOR
+    neo_allocator_thread_leave();
+#endif
+    return NULL;
+}
+
+/* Start marker thread. Called by the mutator inside a public GC function, so the new lock is returned locked. */
+static void gc_marker_start(gc_context_t *self) {
+    neo_dassert(self != NULL && !self->marker, "Invalid arguments");
+    struct gc_marker_t *m = neo_memalloc(NULL, sizeof(*m));
+    memset(m, 0, sizeof(*m));
+    neo_assert(pthread_mutex_init(&m->lock, NULL) == 0, "Failed to create marker lock");
+    neo_assert(pthread_cond_init(&m->wake, NULL) == 0, "Failed to create marker condition");
+    pthread_mutex_lock(&m->lock);
+    self->marker = m;
+    neo_assert(pthread_create(&m->thread, NULL, &gc_marker_main, self) == 0, "Failed to create marker thread");
+    gctrace("Started background marker");
+}
+
+static void gc_marker_stop(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    struct gc_marker_t *m = self->marker;
+    if (!m) { return; }
+    pthread_mutex_lock(&m->lock);
+    m->quit = true;
+    pthread_cond_signal(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->thread, NULL);
+    pthread_cond_destroy(&m->wake);
+    pthread_mutex_destroy(&m->lock);
+    neo_memalloc(m, 0);
+    self->marker = NULL;
+    gctrace("Stopped background marker");
+}
+
+static NEO_AINLINE void gc_marker_wake(gc_context_t *self) {
+    if (self->marker) { pthread_cond_signal(&self->marker->wake); }
+}
+
+static NEO_AINLINE void gc_lock(gc_context_t *self) {
+    if (self->marker) { pthread_mutex_lock(&self->marker->lock); }
+}
+
+static NEO_AINLINE void gc_unlock(gc_context_t *self) {
+    if (self->marker) { pthread_mutex_unlock(&self->marker->lock); }
+}
+#else
+#   define gc_marker_stop(self) (void)(self)
+#   define gc_marker_wake(self) (void)(self)
+#   define gc_lock(self) (void)(self)
+#   define gc_unlock(self) (void)(self)
+#endif
+
+/* ---- Parallel marking ---- */
+
 /*
-** 2. Sweep phase: Reclaim all garbage objects.
+** Stop-the-world marking with gc_context_t.mark_threads threads, the collecting thread is worker 0.
+** The table does not change during a stop-the-world collection, so workers resolve pointers without locking.
+** Mark bits are set with an atomic test-and-set: Nursery objects in the side bitmaps of their blocks,
+** all other objects in a side bitmap indexed by table slot, which is folded into the flags before sweeping.
+** Each worker owns a Chase-Lev work stealing deque of grey objects (see Le et al., "Correct and Efficient
+** Work-Stealing for Weak Memory Models", 2013). Idle workers steal from random victims.
+** Marking terminates when all workers are idle, because grey objects are only pushed by active workers.
+*/
+#if GC_CONCURRENT
+
+typedef struct gc_deque_buf_t {
+    int64_t cap; /* Power of two. */
+    struct gc_deque_buf_t *retired; /* Previous buffer, thieves might still read it, so it's freed after marking. */
+    uintptr_t items[]; /* Table or large object entries, or nursery objects tagged with GC_DEQUE_NURSERY. */
+} gc_deque_buf_t;
+#define GC_DEQUE_NURSERY 1 /* Tag bit of nursery objects, which have no entry. */
+
+typedef struct NEO_ALIGN(64) gc_mark_worker_t {
+    gc_context_t *ctx;
+    int64_t top; /* Thieves steal here. */
+    int64_t bottom; /* Owner pushes and takes here. */
+    gc_deque_buf_t *buf;
+    uint32_t id;
+    uint32_t seed; /* Random victim selection. */
+    size_t probes; /* Table probes of this worker, added to gc_context_t.probes after marking. */
+    pthread_t thread;
+} gc_mark_worker_t;
+
+struct gc_mark_pool_t {
+    gc_mark_worker_t *workers; /* [0] is the collecting thread. */
+    uint32_t len;
+    uint32_t idle; /* Number of idle workers, marking terminates when all are idle. */
+    uint32_t finished; /* Number of helpers, which finished the current epoch. */
+    uint64_t epoch; /* Incremented for each parallel mark phase. */
+    bool quit;
+    pthread_mutex_t lock;
+    pthread_cond_t start; /* Signalled when a new epoch starts. */
+    pthread_cond_t done; /* Signalled when all helpers finished the epoch. */
+    uint64_t *slotmarks; /* Side mark bitmap of non-nursery objects, indexed by table slot. */
+    size_t slotmarks_len; /* Number of 64-bit words in <slotmarks>. */
+};
+
+#define GC_DEQUE_INIT_CAP (1<<10)
+
+static gc_deque_buf_t *deque_buf_alloc(int64_t cap) {
+    gc_deque_buf_t *buf = neo_memalloc(NULL, sizeof(*buf)+(size_t)cap*sizeof(*buf->items));
+    buf->cap = cap;
+    buf->retired = NULL;
+    return buf;
+}
+
+static NEO_NOINLINE gc_deque_buf_t *deque_grow(gc_mark_worker_t *w, gc_deque_buf_t *old, int64_t t, int64_t b) {
+    gc_deque_buf_t *buf = deque_buf_alloc(old->cap<<1);
+    for (int64_t i = t; i < b; ++i) {
+        buf->items[i&(buf->cap-1)] = __atomic_load_n(&old->items[i&(old->cap-1)], __ATOMIC_RELAXED);
+    }
+    buf->retired = old;
+    __atomic_store_n(&w->buf, buf, __ATOMIC_RELEASE);
+    return buf;
+}
+
+static NEO_AINLINE void deque_push(gc_mark_worker_t *w, uintptr_t p) {
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    gc_deque_buf_t *buf = __atomic_load_n(&w->buf, __ATOMIC_RELAXED);
+    if (neo_unlikely(b-t > buf->cap-1)) { buf = deque_grow(w, buf, t, b); }
+    __atomic_store_n(&buf->items[b&(buf->cap-1)], p, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b+1, __ATOMIC_RELAXED);
+}
+
+static NEO_AINLINE uintptr_t deque_take(gc_mark_worker_t *w) {
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED)-1;
+    gc_deque_buf_t *buf = __atomic_load_n(&w->buf, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    uintptr_t p = 0;
+    if (t <= b) {
+        p = __atomic_load_n(&buf->items[b&(buf->cap-1)], __ATOMIC_RELAXED);
+        if (t == b) { /* Last item, race against thieves. */
+            if (!__atomic_compare_exchange_n(&w->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) { p = 0; }
+            __atomic_store_n(&w->bottom, b+1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&w->bottom, b+1, __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+static uintptr_t deque_steal(gc_mark_worker_t *w) {
+    int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) { return 0; }
+    gc_deque_buf_t *buf = __atomic_load_n(&w->buf, __ATOMIC_ACQUIRE);
+    uintptr_t p = __atomic_load_n(&buf->items[t&(buf->cap-1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) { return 0; } /* Lost race. */
+    return p;
+}
+
+/* Atomically mark table or large object and push it, if it was not marked before. */
+static NEO_AINLINE void par_mark_obj(gc_mark_worker_t *w, gc_fatptr_t *p) {
+    gc_context_t *self = w->ctx;
+    size_t i = p->span ? self->slots+(size_t)(p-self->large) : (size_t)(p-self->trackedallocs); /* Large objects are indexed after the table slots. */
+    uint64_t *word = self->mark_pool->slotmarks+(i>>6);
+    uint64_t bit = 1ull<<(i&63);
+    if (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) { return; } /* Already marked by any worker. */
+    if (p->flags & GCF_LEAF) { return; } /* Leaf object, child-scanning is redundant. */
+    deque_push(w, (uintptr_t)p);
+}
+
+/* Atomically mark nursery object at granule <g> of its block and push it, if it was not marked before. */
+static NEO_AINLINE void par_mark_nursery(gc_mark_worker_t *w, void *ptr, gc_nursery_block_t *blk, size_t g) {
+    uint64_t bit = 1ull<<(g&63);
+    if (__atomic_fetch_or(blk->marks+(g>>6), bit, __ATOMIC_RELAXED) & bit) { return; } /* Already marked by any worker. */
+    if (bitmap_test(blk->leafs, g)) { return; } /* Leaf object, child-scanning is redundant. */
+    deque_push(w, (uintptr_t)ptr|GC_DEQUE_NURSERY);
+}
+
+static NEO_AINLINE void par_mark_ptr(gc_mark_worker_t *w, const void *ptr) {
+    gc_context_t *self = w->ctx;
+    if (neo_unlikely((uintptr_t)ptr < self->bndmin || (uintptr_t)ptr > self->bndmax)) { return; } /* Out of bounds. */
+    gc_nursery_block_t *blk = gc_nursery_block_of(ptr);
+    if (nursery_set_contains(self, blk)) {
+        size_t g = gc_nursery_granule(blk, ptr);
+        if (((uintptr_t)ptr&(GC_ALLOC_GRANULARITY-1)) || !bitmap_test(blk->starts, g)) { return; } /* Interior pointer, header or free memory. */
+        if (__atomic_load_n(&blk->marks[g>>6], __ATOMIC_RELAXED) & (1ull<<(g&63))) { return; } /* Already marked. */
+        par_mark_nursery(w, (void *)ptr, blk, g);
+        return;
+    }
+    gc_fatptr_t *p = neo_likely(self->slots) ? lookup_ptr_probes(self, ptr, &w->probes) : NULL;
+    if (!p && large_candidate(self, ptr)) { p = large_find(self, ptr); }
+    if (p) { par_mark_obj(w, p); }
+}
+
+static void par_scan_region(gc_mark_worker_t *w, const void *p, size_t len) {
+    const void **pp = (const void **)p;
+    const void **end = (const void **)p+len;
+    for (; pp < end; ++pp) {
+        par_mark_ptr(w, gc_load_ref(pp));
+    }
+}
+
+static void par_scan_children(gc_mark_worker_t *w, const gc_fatptr_t *p) {
+    if (!p->oid) { par_scan_region(w, p->ptr, ptrsize(*p)); return; }
+    const gc_layout_t *l = w->ctx->layouts+(p->oid-1);
+    const void **slots = (const void **)p->ptr;
+    layout_foreach_ref(l, ptrsize(*p), i) { par_mark_ptr(w, gc_load_ref(slots+i)); }
+}
+
+/* Scan child nodes of a deque item. */
+static NEO_AINLINE void par_scan_item(gc_mark_worker_t *w, uintptr_t item) {
+    if (item&GC_DEQUE_NURSERY) {
+        gc_fatptr_t view = nursery_view((void *)(item&~(uintptr_t)GC_DEQUE_NURSERY));
+        par_scan_children(w, &view);
+    } else {
+        par_scan_children(w, (const gc_fatptr_t *)item);
+    }
+}
+
+static bool par_has_work(const struct gc_mark_pool_t *pool) {
+    for (uint32_t i = 0; i < pool->len; ++i) {
+        if (__atomic_load_n(&pool->workers[i].top, __ATOMIC_ACQUIRE) < __atomic_load_n(&pool->workers[i].bottom, __ATOMIC_ACQUIRE)) { return true; }
+    }
+    return false;
+}
+
+static uintptr_t par_steal(gc_mark_worker_t *w) {
+    struct gc_mark_pool_t *pool = w->ctx->mark_pool;
+    w->seed = w->seed*1103515245u+12345u;
+    uint32_t start = (w->seed>>16)%pool->len;
+    for (uint32_t i = 0; i < pool->len; ++i) {
+        uint32_t victim = (start+i)%pool->len;
+        if (victim == w->id) { continue; }
+        uintptr_t p = deque_steal(pool->workers+victim);
+        if (p) { return p; }
+    }
+    return 0;
+}
+
+/* Trace until all workers are idle. */
+static void par_mark_loop(gc_mark_worker_t *w) {
+    struct gc_mark_pool_t *pool = w->ctx->mark_pool;
+    uintptr_t p;
+    for (;;) {
+        while ((p = deque_take(w)) != 0) { par_scan_item(w, p); }
+        if ((p = par_steal(w)) != 0) {
+            par_scan_item(w, p);
+            continue;
+        }
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) == pool->len) { return; } /* All deques are empty. */
+            if (par_has_work(pool)) {
+                __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void *gc_mark_worker_main(void *arg) {
+    gc_mark_worker_t *w = (gc_mark_worker_t *)arg;
+    struct gc_mark_pool_t *pool = w->ctx->mark_pool;
+    uint64_t epoch = 0;
+#ifndef NEO_USE_SYSTEM_ALLOCATOR
+    neo_allocator_thread_enter();
+#endif
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->epoch == epoch) { pthread_cond_wait(&pool->start, &pool->lock); }
+        if (pool->quit) { break; }
+        epoch = pool->epoch;
+        pthread_mutex_unlock(&pool->lock);
+        par_mark_loop(w);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->len-1) { pthread_cond_signal(&pool->done); }
+    }
+    pthread_mutex_unlock(&pool->lock);
+#ifndef NEO_USE_SYSTEM_ALLOCATOR
+    neo_allocator_thread_leave();
+#endif
+    return NULL;
+}
+
+static void gc_mark_pool_stop(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    struct gc_mark_pool_t *pool = self->mark_pool;
+    if (!pool) { return; }
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 1; i < pool->len; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (uint32_t i = 0; i < pool->len; ++i) {
+        neo_memalloc(pool->workers[i].buf, 0);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    neo_memalloc(pool->slotmarks, 0);
+    neo_memalloc(pool->workers, 0);
+    neo_memalloc(pool, 0);
+    self->mark_pool = NULL;
+}
+
+static void gc_mark_pool_start(gc_context_t *self, uint32_t len) {
+    neo_dassert(self != NULL && !self->mark_pool && len > 1, "Invalid arguments");
+    struct gc_mark_pool_t *pool = neo_memalloc(NULL, sizeof(*pool));
+    memset(pool, 0, sizeof(*pool));
+    pool->len = len;
+    pool->workers = neo_memalloc(NULL, len*sizeof(*pool->workers));
+    memset(pool->workers, 0, len*sizeof(*pool->workers));
+    neo_assert(pthread_mutex_init(&pool->lock, NULL) == 0, "Failed to create mark pool lock");
+    neo_assert(pthread_cond_init(&pool->start, NULL) == 0, "Failed to create mark pool condition");
+    neo_assert(pthread_cond_init(&pool->done, NULL) == 0, "Failed to create mark pool condition");
+    self->mark_pool = pool;
+    for (uint32_t i = 0; i < len; ++i) {
+        gc_mark_worker_t *w = pool->workers+i;
+        w->ctx = self;
+        w->id = i;
+        w->seed = i+1;
+        w->buf = deque_buf_alloc(GC_DEQUE_INIT_CAP);
+        if (i) { neo_assert(pthread_create(&w->thread, NULL, &gc_mark_worker_main, w) == 0, "Failed to create mark worker thread"); }
+    }
+    gctrace("Started %"PRIu32" mark workers", len-1);
+}
+
+/* 1. Parallel mark phase, same as gc_mark but traced by all workers of the pool. */
+static void gc_mark_parallel(gc_context_t *self) {
+    neo_dassert(self != NULL && !self->minor, "Invalid arguments");
+    if (neo_unlikely(!self->alloc_len)) { return; }
+    if (self->mark_pool && self->mark_pool->len != self->mark_threads) { gc_mark_pool_stop(self); }
+    if (!self->mark_pool) { gc_mark_pool_start(self, self->mark_threads); }
+    struct gc_mark_pool_t *pool = self->mark_pool;
+    size_t words = (self->slots+self->large_len+63)>>6;
+    if (pool->slotmarks_len < words) {
+        pool->slotmarks = neo_memalloc(pool->slotmarks, words*sizeof(*pool->slotmarks));
+        pool->slotmarks_len = words;
+    }
+    if (words) { memset(pool->slotmarks, 0, words*sizeof(*pool->slotmarks)); } /* Empty if all objects are inside the nursery. */
+    pool->idle = 0;
+    gc_mark_worker_t *w = pool->workers;
+    for (size_t i = 0; i < self->slots; ++i) { /* 1. Mark all root objects. */
+        if (self->trackedallocs[i].hash && (self->trackedallocs[i].flags & GCF__PINNED)) {
+            par_mark_obj(w, self->trackedallocs+i);
+        }
+    }
+    for (size_t i = 0; i < self->large_len; ++i) {
+        if (self->large[i].flags & GCF__PINNED) { par_mark_obj(w, self->large+i); }
+    }
+    if (self->nursery_pinned) {
+        for (gc_nursery_block_t *blk = self->nursery_blocks; blk; blk = blk->next) {
+            nursery_foreach(blk, starts, ptr) {
+                if (nursery_flags(ptr) & GCF__PINNED) { par_mark_nursery(w, ptr, blk, ptr_g); }
+            }
+        }
+    }
+    par_scan_region(w, self->stk, gc_stack_len(self)); /* 2. Mark all stack objects. */
+    pthread_mutex_lock(&pool->lock); /* 3. Start helpers and trace. */
+    pool->finished = 0;
+    ++pool->epoch;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    par_mark_loop(w);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finished != pool->len-1) { pthread_cond_wait(&pool->done, &pool->lock); }
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < self->slots; ++i) { /* 4. Fold side mark bits into the flags for sweeping. */
+        if (pool->slotmarks[i>>6] & (1ull<<(i&63))) { self->trackedallocs[i].flags |= GCF_MARK; }
+    }
+    for (size_t i = 0; i < self->large_len; ++i) {
+        size_t j = self->slots+i;
+        if (pool->slotmarks[j>>6] & (1ull<<(j&63))) { self->large[i].flags |= GCF_MARK; }
+    }
+    for (uint32_t i = 0; i < pool->len; ++i) { /* 5. Free retired deque buffers. */
+        gc_mark_worker_t *wi = pool->workers+i;
+        neo_dassert(wi->top == wi->bottom, "Deque not empty");
+        wi->top = wi->bottom = 0;
+        self->probes += wi->probes;
+        wi->probes = 0;
+        for (gc_deque_buf_t *buf = wi->buf->retired, *next; buf; buf = next) {
+            next = buf->retired;
+            neo_memalloc(buf, 0);
+        }
+        wi->buf->retired = NULL;
+    }
+}
+#else
+#   define gc_mark_pool_stop(self) (void)(self)
+#endif
+
+/* Next collection triggers: The live heap grown by the growth factor (sweepfactor). */
+static void gc_set_thresholds(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    self->threshold = self->alloc_len+(size_t)((double)self->alloc_len*self->sweepfactor)+1;
+    size_t bytes = self->alloc_bytes+(size_t)((double)self->alloc_bytes*self->sweepfactor);
+    bytes = bytes < GC_MIN_HEAP_BYTES ? GC_MIN_HEAP_BYTES : bytes;
+    if (self->heap_limit && bytes > self->heap_limit) { bytes = self->heap_limit; } /* Collect before the hard limit is hit. */
+    self->byte_threshold = bytes;
+}
+
+static void freelist_push(gc_context_t *self, const gc_fatptr_t *p) {
+    neo_dassert(self != NULL && p != NULL, "Invalid arguments");
+    if (neo_unlikely(self->free_len == self->free_cap)) { /* The buffer is kept across cycles. */
+        self->free_cap = self->free_cap ? self->free_cap<<1 : 1<<8;
+        self->freelist = neo_memalloc(self->freelist, self->free_cap*sizeof(*self->freelist));
+    }
+    self->freelist[self->free_len++] = *p;
+}
+
+/* Append dead object to the finalization queue. */
+static void finalizer_push(gc_context_t *self, void *ptr) {
+    neo_dassert(self != NULL && ptr != NULL, "Invalid arguments");
+    if (self->finq_head && self->finq_head == self->finq_len) { self->finq_head = self->finq_len = 0; } /* Drained, restart at the front. */
+    if (neo_unlikely(self->finq_len == self->finq_cap)) {
+        self->finq_cap = self->finq_cap ? self->finq_cap<<1 : 1<<6;
+        self->finq = neo_memalloc(self->finq, self->finq_cap*sizeof(*self->finq));
+    }
+    self->finq[self->finq_len++] = ptr;
+}
+
+/*
+** Release up to <n> dead objects, which were detached by a previous sweep.
+** Pending objects are unreachable and not tracked anymore, so releasing them can be deferred to allocations or the background marker.
+** Each object is popped before it's released, so destructor hooks may allocate.
+*/
+static void sweep_pending(gc_context_t *self, size_t n) {
+    neo_dassert(self != NULL, "self is NULL");
+    while (n-- && self->free_len) {
+        gc_fatptr_t p = self->freelist[--self->free_len];
+        release_obj(self, &p);
+    }
+}
+
+/* Dead object: Queue it for finalization (returns true, the object is kept) or append it to the freelist. */
+static bool sweep_dead(gc_context_t *self, gc_fatptr_t *p, bool defer, size_t *bytes) {
+    if (defer && !(p->flags & GCF_FINALIZED)) { /* Keep object and its children until it's finalized. */
+        p->flags |= GCF_QUEUED;
+        finalizer_push(self, p->ptr);
+        return true;
+    }
+    freelist_push(self, p);
+    *bytes += gc_granules2bytes(p->grasize);
+    --self->alloc_len;
+    return false;
+}
+
+/* Clear the remembered flag and promote survivor to the old generation. */
+static NEO_AINLINE void promote_obj(gc_fatptr_t *p) {
+    p->flags &= ~GCF_REMEMBERED&255;
+    if ((p->flags & GCF_MARK) || ((p->flags & GCF_NURSERY) && nursery_marked(p->ptr))) {
+        p->flags &= ~GCF_MARK&255;
+        p->flags |= GCF_OLD;
+    }
+}
+
+/*
+** 2. Sweep phase: Detach all garbage objects from the table and reclaim nursery objects.
+** Individually allocated objects are released lazily (sweep_pending), not inside the pause.
 */
 static NEO_HOTPROC void gc_sweep(gc_context_t *self) {
     neo_dassert(self != NULL, "self is NULL");
     size_t i, j, k, nj, nh;
+    gc_flags_t alive = self->minor ? GCF_MARK|GCF_ROOT|GCF_QUEUED|GCF_OLD : GCF_MARK|GCF_ROOT|GCF_QUEUED; /* Minor collections only reclaim young objects. */
+    bool defer = self->dtor_hook && self->finalize_deferred;
+#define is_alive(e) (((e).flags & alive) || (((e).flags & GCF_NURSERY) && nursery_marked((e).ptr)))
+    self->young_len = 0; /* All survivors are promoted, so the young generation and the remembered set are empty afterwards. */
+    self->remset_len = 0;
     if (neo_unlikely(!self->alloc_len)) { return; }
-    self->free_len = 0;
-    /* 1. Collect all free objects. */
-    for (i = 0; i < self->slots; ++i) {
-        if (neo_unlikely(!self->trackedallocs[i].hash)) { continue; }
-        if (self->trackedallocs[i].flags & (GCF_MARK | GCF_ROOT)) { continue; } /* Alive object, ignore. */
-        ++self->free_len; /* Free object, collect. */
-    }
-    self->freelist = neo_memalloc(NULL, sizeof(*self->freelist)*self->free_len); /* Allocate freelist. TODO: reuse buffer */
-    i = 0; k = 0;
+    uint64_t clock = neo_hp_clock_us();
+    size_t start = self->free_len; /* Objects of previous cycles might still be pending. */
+    size_t bytes = 0;
+    /* 1. Detach all free objects. */
+    i = 0;
     while (i < self->slots) {
-        if (!self->trackedallocs[i].hash || (self->trackedallocs[i].flags & (GCF_MARK | GCF_ROOT))) { ++i; continue; }
-        self->freelist[k++] = self->trackedallocs[i];
+        if (!self->trackedallocs[i].hash || is_alive(self->trackedallocs[i])) { ++i; continue; }
+        if (sweep_dead(self, self->trackedallocs+i, defer, &bytes)) { ++i; continue; }
+        --self->table_len;
         memset(self->trackedallocs+i, 0, sizeof(*self->trackedallocs));
         j = i;
         for (;;) {
-            nj = (j+1) % self->slots;
+            nj = gc_next_slot(self, j);
             nh = self->trackedallocs[nj].hash;
             if (nh && probe_dist(self, nj, nh) > 0) {
                 memcpy(self->trackedallocs+j, self->trackedallocs+nj, sizeof(*self->trackedallocs));
@@ -228,29 +1537,52 @@ static NEO_HOTPROC void gc_sweep(gc_context_t *self) {
                 break;
             }
         }
-        ++self->alloc_len;
+    }
+    for (i = k = 0; i < self->large_len; ++i) { /* Large objects are compacted in one pass. */
+        if (is_alive(self->large[i]) || sweep_dead(self, self->large+i, defer, &bytes)) {
+            promote_obj(self->large+i);
+            self->large[k++] = self->large[i];
+        }
+    }
+    self->large_len = k;
+    for (gc_nursery_block_t *blk = self->nursery_blocks; blk; blk = blk->next) { /* Nursery objects are swept by walking the start bitmaps. */
+        memset(blk->lines, 0, sizeof(blk->lines)); /* Recompute line occupancy from the survivors. */
+        for (size_t l = 0; l < GC_NURSERY_HEADER_LINES; ++l) { bitmap_set(blk->lines, l); }
+        nursery_foreach(blk, starts, ptr) {
+            gc_fatptr_t view = nursery_view(ptr);
+            if (is_alive(view) || sweep_dead(self, &view, defer, &bytes)) { /* Dead objects are released with the freelist below. */
+                nursery_mark_lines(gc_nursery_hdr_of(ptr), view.grasize+1);
+                promote_obj(&view);
+                nursery_set_flags(self, ptr, view.flags);
+            }
+        }
+        memset(blk->marks, 0, sizeof(blk->marks)); /* Clear side mark bitmap. */
     }
     for (i = 0; i < self->slots; ++i) {
         if (neo_unlikely(self->trackedallocs[i].hash == 0)) { continue; }
-        if (self->trackedallocs[i].flags & GCF_MARK) {
-            self->trackedallocs[i].flags &= ~GCF_MARK&255;
-        }
+        promote_obj(self->trackedallocs+i);
     }
+#undef is_alive
     shrink_alloc_map(self);
-    self->threshold = self->alloc_len+(size_t)((double)self->alloc_len*self->sweepfactor)+1;
-    /* 2. Free all collected objects. */
-    for (i = 0; i < self->free_len; ++i) {
-        if (self->freelist[i].ptr) {
-            if (self->dtor_hook) { (*self->dtor_hook)(self->freelist[i].ptr); }
-            void *p = self->freelist[i].ptr;
-            neo_memalloc(p, 0); /* Free individual allocation. */
-        }
+    gc_set_thresholds(self);
+    /* 2. Free dead nursery objects, so their lines can be recycled. Individual allocations are released lazily by sweep_pending. */
+    size_t end = self->free_len;
+    self->alloc_bytes -= bytes;
+    self->cycle.objects_freed += end-start;
+    self->cycle.bytes_freed += bytes;
+    self->free_len = start; /* Allocations inside destructor hooks only release pending objects before <i>. */
+    for (i = start; i < end; ++i) {
+        gc_fatptr_t p = self->freelist[i];
+        if (p.flags & GCF_NURSERY) { release_obj(self, &p); }
+        else { self->freelist[self->free_len++] = p; }
     }
-    neo_memalloc(self->freelist, 0); /* Free freelist. */
-    self->freelist = NULL;
-    self->free_len = 0;
+    nursery_rebuild_recycle(self);
+    if (self->free_len && (!self->dtor_hook || defer)) { gc_marker_wake(self); } /* The background marker releases them without a destructor hook. */
+    self->cycle.sweep_us = neo_hp_clock_us()-clock;
 }
 
+static void objfree(gc_context_t *self, void *ptr);
+
 void gc_init(gc_context_t *self, const void *stk, size_t stk_spdelta) {
     neo_dassert(self != NULL, "self is NULL");
     neo_assert(stk != NULL, "Invalid stack pointer");
@@ -258,27 +1590,85 @@ void gc_init(gc_context_t *self, const void *stk, size_t stk_spdelta) {
     memset(self, 0, sizeof(*self));
     self->stk = stk;
     self->stk_spdelta = stk_spdelta;
+    self->stk_top = NULL; /* Unknown, scan whole stack until the VM publishes its top. */
     self->trackedallocs = NULL;
     self->freelist = NULL;
     self->bndmin = UINTPTR_MAX;
     self->loadfactor = GC_LOADFACTOR;
     self->sweepfactor = GC_SWEEPFACTOR;
+    self->byte_threshold = GC_MIN_HEAP_BYTES;
+    self->page_size = neo_osi->page_size ? neo_osi->page_size : 0x1000;
+    self->minor_threshold = GC_MINOR_THRESHOLD;
+    self->mark_stack_max = GC_MARK_STACK_MAX;
+    self->mempolicy = neo_mempolicy_get_default();
+    self->numa_node = neo_osi_numa_node();
+#ifndef NEO_USE_SYSTEM_ALLOCATOR
+    self->heap = neo_allocator_heap_acquire();
+    if (self->mempolicy) { neo_allocator_heap_set_policy(self->heap, self->mempolicy, self->numa_node); }
+#endif
+    self->prof_rng = (neo_hp_clock_us()^(uint64_t)(uintptr_t)self)|1; /* Any nonzero seed. */
     gctrace("Initialized gc with stack bounds: [%p, %p], delta: %zub", stk, stk+stk_spdelta, stk_spdelta);
 }
 
 void gc_free(gc_context_t *self) {
     neo_dassert(self != NULL, "self is NULL");
-    gc_sweep(self);
+    gc_marker_stop(self);
+    gc_mark_pool_stop(self);
+    if (self->phase == GC_PHASE_MARK) { gc_mark_finish(self); } /* Finish pending cycle, so marks are cleared. */
+    if (self->heap && !self->dtor_hook) { /* Nothing observes individual frees, objects are released with the heap. */
+        for (size_t i = 0; i < self->free_len; ++i) { /* Only large spans of pending objects must be unmapped. */
+            if (self->freelist[i].span) { span_unmap(self->freelist[i].ptr, (size_t)self->freelist[i].span*self->page_size); }
+        }
+        self->free_len = 0;
+    } else {
+        gc_finalize(self, SIZE_MAX);
+        self->finalize_deferred = false; /* Remaining objects are finalized by the last sweep. */
+        gc_sweep(self);
+        sweep_pending(self, SIZE_MAX);
+    }
 #if NEO_DBG
     for (size_t i = 0; i < self->slots; ++i) { /* Free all roots. */
         if (self->trackedallocs[i].ptr && self->trackedallocs[i].flags & GCF_ROOT) {
             neo_warn("root memory allocation still alive: %p, index: %zu, size: %zub" PRIu32, self->trackedallocs[i].ptr, i, gc_bytes2granules(self->trackedallocs[i].grasize));
-            gc_objfree(self, self->trackedallocs[i].ptr);
+            objfree(self, self->trackedallocs[i].ptr);
         }
     }
+    for (size_t i = self->large_len; i--;) {
+        if (!(self->large[i].flags & GCF_ROOT)) { continue; }
+        neo_warn("root memory allocation still alive: %p, size: %zub", self->large[i].ptr, gc_granules2bytes(self->large[i].grasize));
+        objfree(self, self->large[i].ptr);
+    }
 #endif
+    for (size_t i = 0; i < self->large_len; ++i) { /* Unmap remaining large objects. */
+        span_unmap(self->large[i].ptr, (size_t)self->large[i].span*self->page_size);
+    }
+    for (size_t i = 0; i < self->large_spare_len; ++i) {
+        span_unmap(self->large_spare[i].base, self->large_spare[i].len);
+    }
+    for (gc_nursery_block_t *blk = self->nursery_blocks, *next; blk; blk = next) { /* Free remaining nursery blocks. */
+        next = blk->next;
+        nursery_block_free(blk);
+    }
+    for (gc_nursery_block_t *blk = self->nursery_spare, *next; blk; blk = next) {
+        next = blk->next;
+        nursery_block_free(blk);
+    }
+    if (self->heap) { /* Release all remaining individual objects at once. */
+        neo_allocator_heap_free_all(self->heap);
+        neo_allocator_heap_release(self->heap);
+    }
     neo_memalloc(self->trackedallocs, 0);
     neo_memalloc(self->freelist, 0);
+    neo_memalloc(self->remset, 0);
+    neo_memalloc(self->nursery_set, 0);
+    neo_memalloc(self->grey, 0);
+    neo_memalloc(self->finq, 0);
+    neo_memalloc(self->large, 0);
+    for (uint32_t i = 0; i < self->layout_len; ++i) { neo_memalloc(self->layouts[i].refmap, 0); }
+    neo_memalloc(self->layouts, 0);
+    neo_memalloc(self->prof_sites, 0);
+    neo_memalloc(self->prof_index, 0);
+    neo_memalloc(self->prof_objs, 0);
     memset(self, 0, sizeof(*self));
     gctrace("Offline");
 }
@@ -293,69 +1683,458 @@ void gc_resume(gc_context_t *self) {
     self->is_paused = false;
 }
 
-NEO_HOTPROC void gc_collect(gc_context_t *self) {
+/* ---- Telemetry ---- */
+
+static void stats_begin(gc_context_t *self, gc_trigger_t trigger) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_stats_t *s = &self->cycle;
+    memset(s, 0, sizeof(*s));
+    s->id = self->cycles+1;
+    s->trigger = trigger;
+    s->minor = self->minor;
+    s->objects_before = self->alloc_len;
+    s->bytes_before = self->alloc_bytes;
+    s->probes = self->probes; /* Converted into the delta by stats_end. */
+}
+
+/* Account a pause, which started at <start>. If <sweep> is true, the pause includes the sweep (measured by gc_sweep). */
+static void stats_pause(gc_context_t *self, uint64_t start, bool sweep) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_stats_t *s = &self->cycle;
+    uint64_t dt = neo_hp_clock_us()-start;
+    s->pause_us = dt > s->pause_us ? dt : s->pause_us;
+    s->mark_us += sweep ? dt-(dt < s->sweep_us ? dt : s->sweep_us) : dt;
+    ++s->pauses;
+}
+
+/*
+** Feedback controller: Adapt the heap growth factor (sweepfactor) to hit gc_context_t.cpu_target.
+** The GC time of the cycle is compared against the time since the end of the last major cycle.
+** The adjustment per cycle is limited to halving or doubling, so the factor converges without oscillating.
+*/
+static void gc_adapt(gc_context_t *self, const gc_stats_t *s) {
+    neo_dassert(self != NULL && s != NULL, "Invalid arguments");
+    if (s->minor) { return; }
+    uint64_t now = neo_hp_clock_us();
+    uint64_t elapsed = now-self->cycle_end_us;
+    bool first = !self->cycle_end_us;
+    self->cycle_end_us = now;
+    if (self->cpu_target <= 0.0 || first || !elapsed) { return; } /* Disabled, no previous cycle or no clock. */
+    double cpu = (double)(s->mark_us+s->sweep_us)/(double)elapsed;
+    cpu = cpu > 1.0 ? 1.0 : cpu;
+    self->cpu_fraction = self->cpu_fraction > 0.0 ? 0.5*self->cpu_fraction+0.5*cpu : cpu; /* Smooth out single outliers. */
+    double ratio = self->cpu_fraction/self->cpu_target;
+    ratio = ratio < 0.5 ? 0.5 : ratio > 2.0 ? 2.0 : ratio;
+    double factor = self->sweepfactor*ratio;
+    self->sweepfactor = factor < GC_SWEEPFACTOR_MIN ? GC_SWEEPFACTOR_MIN : factor > GC_SWEEPFACTOR_MAX ? GC_SWEEPFACTOR_MAX : factor;
+    gc_set_thresholds(self);
+    gctrace("GC CPU fraction: %f, target: %f, growth factor: %f", self->cpu_fraction, self->cpu_target, self->sweepfactor);
+}
+
+static void stats_end(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_stats_t *s = &self->cycle;
+    s->probes = self->probes-s->probes;
+    s->objects_after = self->alloc_len;
+    s->bytes_after = self->alloc_bytes;
+    self->history[self->cycles++&(GC_STATS_HISTORY-1)] = *s;
+    gctrace(
+        "cycle=%"PRIu64" trigger=%d minor=%d pauses=%"PRIu32" pause_us=%"PRIu64" mark_us=%"PRIu64" sweep_us=%"PRIu64" objects=%zu->%zu bytes=%zu->%zu freed=%zu/%zub probes=%zu",
+        s->id, (int)s->trigger, (int)s->minor, s->pauses, s->pause_us, s->mark_us, s->sweep_us,
+        s->objects_before, s->objects_after, s->bytes_before, s->bytes_after, s->objects_freed, s->bytes_freed, s->probes
+    );
+    gc_adapt(self, s);
+    if (self->stats_hook) { (*self->stats_hook)(s); }
+}
+
+static void collect(gc_context_t *self, gc_trigger_t trigger) {
     neo_dassert(self != NULL, "self is NULL");
     gctrace("Collecting garbage...");
+    uint64_t start = neo_hp_clock_us();
+    if (self->phase == GC_PHASE_MARK) { /* Complete the pending incremental cycle. */
+        gc_mark_finish(self);
+        stats_pause(self, start, true);
+        stats_end(self);
+        return;
+    }
+    stats_begin(self, trigger);
+#if GC_CONCURRENT
+    if (self->mark_threads > 1) { gc_mark_parallel(self); }
+    else {
+        gc_mark(self);
+        gc_mark_drain(self, UINT64_MAX);
+    }
+#else
     gc_mark(self);
+    gc_mark_drain(self, UINT64_MAX);
+#endif
     gc_sweep(self);
+    stats_pause(self, start, true);
+    stats_end(self);
+}
+
+static bool collect_step(gc_context_t *self, gc_trigger_t trigger) {
+    neo_dassert(self != NULL, "self is NULL");
+    uint64_t start = neo_hp_clock_us();
+    uint64_t deadline = start+self->pause_target_us;
+    self->step_allocs = 0;
+    if (self->phase == GC_PHASE_IDLE) { /* Begin new cycle: Shade roots and the VM stack. */
+        gctrace("Starting incremental cycle");
+        stats_begin(self, trigger);
+        self->phase = GC_PHASE_MARK;
+        self->steps = 0;
+        gc_mark(self);
+#if GC_CONCURRENT
+        if (self->concurrent) {
+            if (!self->marker) { gc_marker_start(self); }
+            gc_marker_wake(self);
+        }
+#endif
+    }
+    ++self->steps;
+    if ((self->marker && self->grey_len) || !gc_mark_drain(self, deadline)) { /* Background marker is still tracing or the step is over budget. */
+        stats_pause(self, start, false);
+        return false;
+    }
+    gc_mark_finish(self);
+    stats_pause(self, start, true);
+    stats_end(self);
+    return true;
+}
+
+static void collect_minor(gc_context_t *self, gc_trigger_t trigger) {
+    neo_dassert(self != NULL, "self is NULL");
+    uint64_t start = neo_hp_clock_us();
+    if (self->phase == GC_PHASE_MARK) { /* A minor sweep would clear the marks of the pending major cycle. */
+        gc_mark_finish(self);
+        stats_pause(self, start, true);
+        stats_end(self);
+        return;
+    }
+    gctrace("Collecting young garbage...");
+    self->minor = true;
+    stats_begin(self, trigger);
+    gc_mark(self);
+    gc_mark_drain(self, UINT64_MAX);
+    gc_sweep(self);
+    self->minor = false;
+    stats_pause(self, start, true);
+    stats_end(self);
+}
+
+NEO_HOTPROC void gc_collect(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_lock(self);
+    collect(self, GC_TRIGGER_EXPLICIT);
+    sweep_pending(self, SIZE_MAX); /* Explicit collections release all garbage before returning. */
+    gc_unlock(self);
+}
+
+bool gc_collect_step(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_lock(self);
+    bool done = collect_step(self, GC_TRIGGER_EXPLICIT);
+    gc_unlock(self);
+    return done;
+}
+
+NEO_HOTPROC void gc_collect_minor(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_lock(self);
+    collect_minor(self, GC_TRIGGER_EXPLICIT);
+    sweep_pending(self, SIZE_MAX);
+    gc_unlock(self);
+}
+
+void gc_write_barrier(gc_context_t *self, void *obj, const void *old) {
+    neo_dassert(self != NULL, "self is NULL");
+    if (neo_unlikely(!self->alloc_len)) { return; }
+    gc_lock(self);
+    if (self->phase == GC_PHASE_MARK && old) { /* The overwritten reference might be the last path to an unmarked object, shade it. */
+        size_t grey = self->grey_len;
+        gc_mark_ptr(self, old);
+        if (self->grey_len != grey) { gc_marker_wake(self); }
+    }
+    gc_fatptr_t tmp;
+    gc_fatptr_t *p = resolve_obj(self, obj, &tmp);
+    if (p && (p->flags & (GCF_OLD|GCF_REMEMBERED|GCF_ROOT)) == GCF_OLD) { /* Young, already remembered or root (always scanned) objects are ignored. */
+        obj_set_flags(self, p, (gc_flags_t)(p->flags|GCF_REMEMBERED));
+        if (self->remset_len == self->remset_cap) {
+            self->remset_cap = self->remset_cap ? self->remset_cap<<1 : 1<<6;
+            self->remset = neo_memalloc(self->remset, self->remset_cap*sizeof(*self->remset));
+        }
+        self->remset[self->remset_len++] = obj;
+    }
+    gc_unlock(self);
+}
+
+void gc_store_ref(gc_context_t *self, void *obj, void **slot, void *val) {
+    neo_dassert(self != NULL && slot != NULL, "Invalid arguments");
+    gc_write_barrier(self, obj, gc_load_ref(slot));
+    gc_store_ref_relaxed(slot, val);
 }
 
-static NEO_HOTPROC void *attach_objptr(gc_context_t *self, void *ptr, gc_grasize_t size, gc_flags_t flags) {
+/* Account new object of <size> granules and trigger a collection. Called before the object is allocated, so the collection never sees it half attached. */
+static NEO_HOTPROC void alloc_trigger(gc_context_t *self, gc_grasize_t size) {
     neo_dassert(self != NULL, "self is NULL");
     ++self->alloc_len;
+    self->alloc_bytes += gc_granules2bytes(size);
+    if (self->is_paused) {
+        /* Collections are disabled. */
+    } else if (self->phase == GC_PHASE_MARK) {
+        if (self->marker ? !self->grey_len : ++self->step_allocs >= GC_STEP_INTERVAL) { collect_step(self, GC_TRIGGER_ALLOC); } /* Step or finish the cycle when the background marker is done. */
+    } else if (self->alloc_len > self->threshold || self->alloc_bytes > self->byte_threshold) {
+        gc_trigger_t trigger = self->alloc_len > self->threshold ? GC_TRIGGER_ALLOC : GC_TRIGGER_BYTES;
+        if (self->pause_target_us || self->concurrent) {
+            gctrace("Allocation threshold reached, triggered incremental cycle");
+            collect_step(self, trigger);
+        } else {
+            gctrace("Allocation threshold reached, triggered collection");
+            collect(self, trigger);
+        }
+    } else if (self->generational && self->young_len >= self->minor_threshold) {
+        gctrace("Young allocation threshold reached, triggered minor collection");
+        collect_minor(self, GC_TRIGGER_YOUNG);
+    }
+    ++self->young_len;
+}
+
+static NEO_HOTPROC void *attach_objptr(gc_context_t *self, void *ptr, gc_grasize_t size, gc_flags_t flags, uint32_t oid, uint32_t span) {
+    neo_dassert(self != NULL, "self is NULL");
     self->bndmax = (uintptr_t)ptr+gc_granules2bytes(size) > self->bndmax ? (uintptr_t)ptr+gc_granules2bytes(size) : self->bndmax;
     self->bndmin = (uintptr_t)ptr < self->bndmin ? (uintptr_t)ptr : self->bndmin;
-    grow_alloc_map(self);
-    if (!self->is_paused && self->alloc_len > self->threshold) {
-        gctrace("Allocation threshold reached, triggered collection");
-        gc_collect(self);
+    if (flags & GCF_NURSERY) { /* Nursery objects are described by their header only. */
+        gc_nursery_hdr_t *h = gc_nursery_hdr_of(ptr);
+        h->grasize = size;
+        h->flags = 0;
+        h->oid = oid&0xffffff;
+        nursery_set_flags(self, ptr, flags); /* Side bits of a dead object at the same granule might still be set. */
+    } else if (span) {
+        gc_fatptr_t item = {.ptr = ptr, .grasize = size, .flags = flags, .oid = oid&0xffffff, .hash = 0, .span = span};
+        large_insert(self, &item);
+    } else {
+        ++self->table_len;
+        grow_alloc_map(self);
+        attach_ptr(self, ptr, size, flags, oid);
+    }
+    if (self->phase == GC_PHASE_MARK) { /* Allocate black, the new object is not traced in this cycle. */
+        gc_fatptr_t tmp;
+        mark_obj(resolve_obj(self, ptr, &tmp));
     }
-    attach_ptr(self, ptr, size, flags);
     gctrace("Allocated %zu b / (%"PRIu32" gra) / %f MiB at %p, flags: %x", gc_granules2bytes(size), size, (double)gc_granules2bytes(size)/pow(1024.0, 2.0), ptr, flags);
     return ptr;
 }
 
-static void detach_objptr(gc_context_t *self, void *ptr) {
-    neo_dassert(self != NULL, "self is NULL");
-    detach_ptr(self, ptr);
+static void detach_objptr(gc_context_t *self, void *ptr, const gc_fatptr_t *obj) {
+    neo_dassert(self != NULL && obj != NULL, "Invalid arguments");
+    if (obj->span) { large_remove(self, ptr); }
+    else if (!(obj->flags & GCF_NURSERY)) { detach_ptr(self, ptr); } /* Nursery objects were released by their block. */
+    --self->alloc_len;
     shrink_alloc_map(self);
     self->threshold = 1+self->alloc_len+(self->alloc_len>>1);
     gctrace("Deallocated %p", ptr);
 }
 
+/* Hard heap limit reached: Force a full collection and release all pending objects. Returns false if <bytes> still don't fit. */
+static NEO_NOINLINE bool heap_reserve(gc_context_t *self, size_t bytes) {
+    neo_dassert(self != NULL, "self is NULL");
+    if (!self->is_paused) {
+        gctrace("Heap limit reached, triggered full collection");
+        if (self->phase == GC_PHASE_MARK) { collect(self, GC_TRIGGER_LIMIT); } /* Finish the pending cycle, its black allocations survive it. */
+        collect(self, GC_TRIGGER_LIMIT);
+        sweep_pending(self, SIZE_MAX);
+    }
+    return self->alloc_bytes+bytes <= self->heap_limit;
+}
+
 NEO_HOTPROC void *gc_objalloc(gc_context_t *self, gc_grasize_t size, gc_flags_t flags) {
+    return gc_objalloc_typed(self, size, flags, 0);
+}
+
+NEO_HOTPROC void *gc_objalloc_typed(gc_context_t *self, gc_grasize_t size, gc_flags_t flags, uint32_t oid) {
     neo_dassert(self != NULL, "self is NULL");
     neo_assert(gc_grasize_valid(size), "Invalid gc allocation granule size, must be > 0 and <= 2^32-1: %zu", size);
-    void *ptr = neo_memalloc(NULL, gc_granules2bytes(size));
-    memset(ptr, 0, gc_granules2bytes(size)); /* Zero memory and warmup pages. */
-    return attach_objptr(self, ptr, size, flags);
+    flags = (gc_flags_t)(flags&(~GCF__MANAGED&255)); /* Managed flags are set by the GC. */
+    void *ptr;
+    gc_lock(self);
+    if (neo_unlikely(self->free_len)) { sweep_pending(self, GC_SWEEP_BATCH); } /* Lazy sweeping: Pay for a few dead objects before allocating. */
+    neo_assert(oid <= self->layout_len, "Invalid object layout ID: %"PRIu32, oid);
+    if (oid && !self->layouts[oid-1].refs) { flags = (gc_flags_t)(flags|GCF_LEAF); } /* Layout without references. */
+    if (neo_unlikely(self->heap_limit && self->alloc_bytes+gc_granules2bytes(size) > self->heap_limit) && !heap_reserve(self, gc_granules2bytes(size))) {
+        gc_unlock(self);
+        gctrace("Heap limit exceeded: %zub", self->heap_limit);
+        return NULL;
+    }
+    uint32_t span = 0;
+    alloc_trigger(self, size);
+    if (size <= GC_NURSERY_MAX_GRANULES && !(flags & GCF_ROOT)) { /* Small objects are bump allocated, roots are long-lived. */
+        ptr = nursery_alloc(self, gc_granules2bytes(size));
+        flags = (gc_flags_t)(flags|GCF_NURSERY);
+    } else if (gc_granules2bytes(size) >= GC_LARGE_MIN_BYTES) { /* Large objects get their own span, which is zeroed by the OS. */
+        size_t len;
+        ptr = large_alloc(self, gc_granules2bytes(size), &len);
+        neo_assert(len/self->page_size <= UINT32_MAX, "Large object span is too large: %zub", len);
+        span = (uint32_t)(len/self->page_size);
+    } else {
+        ptr = obj_memalloc(self, gc_granules2bytes(size));
+        memset(ptr, 0, gc_granules2bytes(size)); /* Zero memory and warmup pages. */
+    }
+    attach_objptr(self, ptr, size, flags, oid, span);
+    if (neo_unlikely(self->prof_interval)) { prof_alloc(self, ptr, gc_granules2bytes(size)); }
+    gc_unlock(self); /* The marker might be started by this allocation, gc_marker_start returns its lock held. */
+    return ptr;
+}
+
+static void objfree(gc_context_t *self, void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_fatptr_t tmp;
+    const gc_fatptr_t *p = resolve_obj(self, ptr, &tmp);
+    if (p) {
+        gc_fatptr_t obj = *p; /* The destructor hook might modify the table. */
+        if (obj.flags & GCF_NURSERY) { nursery_set_flags(self, ptr, (gc_flags_t)(obj.flags&~GCF__PINNED&255)); } /* Unpin, before the block forgets the object. */
+        self->alloc_bytes -= gc_granules2bytes(obj.grasize);
+        release_obj(self, &obj);
+        detach_objptr(self, ptr, &obj);
+    }
 }
 
 void gc_objfree(gc_context_t *self, void *ptr) {
     neo_dassert(self != NULL, "self is NULL");
     if (neo_unlikely(!ptr)) { return; }
-    const gc_fatptr_t *p = gc_resolve_ptr(self, ptr);
-    if (p) {
-        if (self->dtor_hook) { (*self->dtor_hook)(ptr); }
-        neo_memalloc(ptr, 0); /* Free individual allocation. */
-        detach_objptr(self, ptr);
+    gc_lock(self);
+    objfree(self, ptr);
+    gc_unlock(self);
+}
+
+size_t gc_prof_get_sites(gc_context_t *self, gc_prof_site_t *out, size_t cap) {
+    neo_dassert(self != NULL && (out != NULL || !cap), "Invalid arguments");
+    gc_lock(self);
+    size_t len = self->prof_sites_len;
+    if (cap) { memcpy(out, self->prof_sites, (cap < len ? cap : len)*sizeof(*out)); }
+    gc_unlock(self);
+    return len;
+}
+
+size_t gc_prof_dump(gc_context_t *self, FILE *f, bool live) {
+    neo_dassert(self != NULL && f != NULL, "Invalid arguments");
+    gc_lock(self);
+    size_t n = 0;
+    for (size_t i = 0; i < self->prof_sites_len; ++i) {
+        const gc_prof_site_t *site = self->prof_sites+i;
+        size_t bytes = live ? site->live_bytes : site->bytes;
+        if (!bytes) { continue; }
+        const char *fn = self->prof_symbolize ? (*self->prof_symbolize)(site->site) : NULL;
+        fprintf(f, "%s%spc_0x%" PRIxPTR " %zu\n", fn ? fn : "", fn ? ";" : "", site->site, bytes); /* Folded stack: frames;...;leaf value */
+        ++n;
     }
+    gc_unlock(self);
+    return n;
+}
+
+void gc_prof_reset(gc_context_t *self) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_lock(self);
+    self->prof_sites_len = 0;
+    self->prof_objs_len = 0;
+    if (self->prof_index) { memset(self->prof_index, 0, self->prof_index_cap*sizeof(*self->prof_index)); }
+    if (self->prof_objs) { memset(self->prof_objs, 0, self->prof_objs_cap*sizeof(*self->prof_objs)); }
+    gc_unlock(self);
+}
+
+gc_fatptr_t *gc_resolve_ptr(gc_context_t *self, const void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_lock(self);
+    gc_fatptr_t *p = resolve_obj(self, ptr, &self->resolved);
+    gc_unlock(self);
+    return p;
 }
 
 void gc_set_flags(gc_context_t *self, void *ptr, gc_flags_t flags) {
     neo_dassert(self != NULL, "self is NULL");
-    gc_fatptr_t *p = gc_resolve_ptr(self, ptr);
-    if (p) { p->flags = flags; }
+    gc_lock(self);
+    gc_fatptr_t tmp;
+    gc_fatptr_t *p = resolve_obj(self, ptr, &tmp);
+    if (p) { obj_set_flags(self, p, (gc_flags_t)((flags&(~GCF__MANAGED&255))|(p->flags&GCF__MANAGED))); }
+    gc_unlock(self);
 }
 
 gc_flags_t gc_get_flags(gc_context_t *self, void *ptr) {
     neo_dassert(self != NULL, "self is NULL");
-    const gc_fatptr_t *p = gc_resolve_ptr(self, ptr);
-    return p ? p->flags : GCF_NONE;
+    gc_lock(self);
+    gc_fatptr_t tmp;
+    const gc_fatptr_t *p = resolve_obj(self, ptr, &tmp);
+    gc_flags_t flags = p ? p->flags : GCF_NONE;
+    gc_unlock(self);
+    return flags;
+}
+
+size_t gc_finalize(gc_context_t *self, size_t n) {
+    neo_dassert(self != NULL, "self is NULL");
+    size_t done = 0;
+    gc_lock(self);
+    while (done < n && self->finq_head < self->finq_len) {
+        void *ptr = self->finq[self->finq_head++];
+        gc_fatptr_t tmp;
+        gc_fatptr_t *p = resolve_obj(self, ptr, &tmp);
+        if (!p || !(p->flags & GCF_QUEUED)) { continue; } /* Freed by gc_objfree in the meantime. */
+        obj_set_flags(self, p, (gc_flags_t)((p->flags&~GCF_QUEUED&255)|GCF_FINALIZED)); /* Memory is reclaimed by the next sweep, if it's still unreachable. */
+        gc_unlock(self); /* The destructor hook runs without the lock, it might allocate or call into the GC. */
+        if (self->dtor_hook) { (*self->dtor_hook)(ptr); }
+        ++done;
+        gc_lock(self);
+    }
+    gc_unlock(self);
+    return done;
+}
+
+uint32_t gc_layout_register(gc_context_t *self, const uint64_t *refmap, gc_grasize_t len) {
+    neo_dassert(self != NULL, "self is NULL");
+    neo_assert(refmap != NULL && len > 0, "Invalid object layout");
+    size_t words = (len+63)>>6;
+    gc_layout_t layout = {.len = len, .refs = 0, .refmap = neo_memalloc(NULL, words*sizeof(*layout.refmap))};
+    memcpy(layout.refmap, refmap, words*sizeof(*layout.refmap));
+    if (len&63) { layout.refmap[words-1] &= (1ull<<(len&63))-1; } /* Clear bits beyond the layout. */
+    for (size_t i = 0; i < words; ++i) {
+        for (uint64_t w = layout.refmap[i]; w; w &= w-1) { ++layout.refs; }
+    }
+    gc_lock(self);
+    neo_assert(self->layout_len < GC_OID_MAX, "Too many object layouts: %"PRIu32, self->layout_len);
+    if (self->layout_len == self->layout_cap) {
+        self->layout_cap = self->layout_cap ? self->layout_cap<<1 : 1<<4;
+        self->layouts = neo_memalloc(self->layouts, self->layout_cap*sizeof(*self->layouts));
+    }
+    self->layouts[self->layout_len++] = layout;
+    uint32_t oid = self->layout_len; /* Index + 1, 0 means no layout. */
+    gc_unlock(self);
+    gctrace("Registered object layout %"PRIu32": %"PRIu32" gra, %"PRIu32" refs", oid, len, layout.refs);
+    return oid;
+}
+
+bool gc_get_stats(gc_context_t *self, size_t age, gc_stats_t *out) {
+    neo_dassert(self != NULL && out != NULL, "Invalid arguments");
+    gc_lock(self);
+    bool found = age < GC_STATS_HISTORY && age < self->cycles;
+    if (found) { *out = self->history[(self->cycles-1-age)&(GC_STATS_HISTORY-1)]; }
+    gc_unlock(self);
+    return found;
+}
+
+uint32_t gc_get_oid(gc_context_t *self, void *ptr) {
+    neo_dassert(self != NULL, "self is NULL");
+    gc_lock(self);
+    gc_fatptr_t tmp;
+    const gc_fatptr_t *p = resolve_obj(self, ptr, &tmp);
+    uint32_t oid = p ? p->oid : 0;
+    gc_unlock(self);
+    return oid;
 }
 
 gc_grasize_t gc_get_size(gc_context_t *self, void *ptr) {
     neo_dassert(self != NULL, "self is NULL");
-    const gc_fatptr_t *p = gc_resolve_ptr(self, ptr);
-    return p ? p->grasize : 0;
+    gc_lock(self);
+    gc_fatptr_t tmp;
+    const gc_fatptr_t *p = resolve_obj(self, ptr, &tmp);
+    gc_grasize_t size = p ? p->grasize : 0;
+    gc_unlock(self);
+    return size;
 }
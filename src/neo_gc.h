@@ -11,10 +11,10 @@ extern "C" {
 #endif
 
 /*
-** The current GC is a conservative, thread local, (tracing) mark and sweep garbage collector.
+** The GC is a conservative, thread local, (tracing) mark and sweep garbage collector.
 ** The GC reclaims syntactic garbage, not semantic garbage, by scanning the VM stack and the heap for pointers.
-** It could be replaced by a faster generational, concurrent, compacting garbage collector but this requires a lot of work.
-** The current GC is simple and works.
+** It is generational (non-moving nursery with in place promotion), marks incrementally, concurrently or in parallel
+** and sweeps lazily, see the sections below. Objects are never moved, so it does not compact the heap.
 **
 ** A memory allocation is considered reachable by the GC if...
 ** -> A pointer points to it, located on the VM stack.
@@ -34,14 +34,132 @@ extern "C" {
 ** TODO: Shrink object header (compressed references, hash?)
 ** TODO: Store record directly on header if value type.
 ** TODO: What happends if data looks like a pointer but isn't?
-** TODO: Generational, concurrent, mark-compact GC, which also allows for sequencial allocation instead of free-listing.
-** TODO: Define object layout with reference types first for faster scanning.
+** TODO: Compaction, blocked on precise heap scanning (see TODO.md).
+**
+** Generations:
+** Small objects are bump allocated inside a nursery of size-aligned blocks, so the block header is found by masking the object address.
+** Each block counts its live objects and is released (or cached) when the count drops to zero.
+** Objects which survive a collection are promoted to the old generation in place (GCF_OLD).
+** Survivors are never copied, because conservative references (e.g. from the VM stack) can't be updated.
+** A minor collection (gc_collect_minor) only traces young objects, starting at the roots, the VM stack and the remembered set.
+** Mutators must call gc_write_barrier before storing a reference into an object (or use gc_store_ref), which records old objects in the remembered set.
+** Automatic minor collections are therefore opt-in (gc_context_t.generational).
+** Blocks are divided into lines. After each sweep, blocks with enough free lines are recycled:
+** Bump allocation continues inside their holes (runs of free lines) before new blocks are allocated.
+** This bounds fragmentation without moving objects.
+**
+** Layouts:
+** Objects allocated by gc_objalloc_typed carry an object ID (gc_fatptr_t.oid), which refers to a layout registered by gc_layout_register.
+** The layout is a bitmap of the granules which hold references, so only these are scanned and
+** integers or floats which look like pointers don't retain objects. The layout repeats for arrays.
+** Objects without a layout (oid 0) are scanned conservatively, every granule is a potential reference.
+**
+** Large objects:
+** Objects of at least GC_LARGE_MIN_BYTES are allocated in the large object space, each in its own page aligned span, mapped from the OS.
+** They're tracked in an array sorted by address instead of the table, so sweeping them doesn't shift table entries.
+** Conservative candidates are only searched there if they are page aligned. Large objects are never moved.
+** The pages of freed spans are returned to the OS (madvise MADV_DONTNEED), the spans are cached for reuse.
+**
+** Private heap:
+** Individually allocated objects come from a private heap of the context (neo_allocator_heap_acquire), so allocation
+** doesn't contend with other isolates. If no destructor hook is installed, gc_free releases all objects at once
+** instead of sweeping them one by one.
+**
+** Placement:
+** The placement policy of the heap and of large object spans (huge pages, NUMA node of the owning thread) is taken from
+** neo_mempolicy_get_default when the context is initialized.
+**
+** Object lookup:
+** Individually allocated objects are tracked in a Robin Hood hashtable with a power of two size, indexed by Fibonacci hashing (no division per probe).
+** Nursery objects are not inside the table: Each one is preceded by a granule header (size, flags and object ID),
+** and nursery blocks carry side bitmaps of object starts, mark bits, leaf and old objects.
+** So a conservative candidate inside a nursery block is identified by a range check, a block set lookup and a bitmap test,
+** and marked (or skipped as leaf) by the side bitmaps alone, without touching the table or the header. Nursery allocation only bumps a pointer and writes the header.
+** Marking never recurses: Marked objects are pushed onto an explicit, bounded mark stack and scanned when popped.
+** If the mark stack overflows, marked objects are rescanned from the table and the nursery mark bitmaps after the stack is drained.
+**
+** Incremental marking:
+** If gc_context_t.pause_target_us is set, a collection is split into bounded marking steps, which are interleaved with allocation.
+** The first step shades the roots and the VM stack.
+** Each step scans grey objects from the mark stack until it's empty or the pause target is reached.
+** Objects allocated during a cycle are marked (allocated black).
+** gc_write_barrier is a snapshot at the beginning barrier: It shades the reference which is about to be overwritten,
+** so every object which was reachable when the cycle started is marked, even if the mutator moves its only reference.
+** The VM stack has no barrier, so the final step rescans it atomically, finishes tracing and sweeps.
+**
+** Concurrent marking:
+** If gc_context_t.concurrent is set, a background marker thread traces the grey worklist while the mutator continues.
+** The marker shares the GC context with the mutator, guarded by a lock which is released after each batch of grey objects.
+** Object contents are not guarded by the lock: The marker loads references atomically, so mutators must store them with gc_store_ref.
+** The mutator finishes the cycle with a short remark pause (roots and live stack region) once the worklist is empty.
+** On platforms without pthreads, concurrent marking falls back to incremental marking.
+**
+** Lazy sweeping:
+** A sweep only detaches dead objects from the table and releases dead nursery objects (bitmap updates).
+** Individually allocated objects are kept in a pending list (gc_context_t.freelist), which is released in small batches
+** by the following allocations or by the background marker, so freeing them is not part of the pause.
+** gc_collect and gc_collect_minor release all pending objects before they return.
+**
+** Finalization:
+** If gc_context_t.finalize_deferred is set, the sweep doesn't call the destructor hook of dead objects.
+** Instead they are flagged (GCF_QUEUED) and appended to a FIFO queue, which the mutator drains at a point of its choice with gc_finalize.
+** Queued objects are traced like roots, so everything a finalizer can reach is still valid when it runs.
+** Objects are finalized in the order they were found dead. Objects which die in the same cycle are not ordered by their references.
+** Finalized objects are reclaimed by the next sweep which finds them unreachable.
+** A finalizer may resurrect its object by storing a reference to it, but the finalizer will never run again (GCF_FINALIZED).
+**
+** Telemetry:
+** Each cycle records its trigger, pause, mark and sweep times, heap size and reclaimed memory and table probes in a gc_stats_t.
+** The stats of the last GC_STATS_HISTORY cycles are kept in a ring buffer (gc_get_stats), gc_context_t.stats_hook is
+** invoked after each cycle, so hosts can export them as an event stream.
+**
+** Heuristics:
+** Collections are triggered by the number of objects (gc_context_t.threshold) or the heap size in bytes (gc_context_t.byte_threshold),
+** both are set to the live heap after the sweep, grown by gc_context_t.sweepfactor.
+** If gc_context_t.cpu_target is set, a feedback controller adapts the growth factor after each major cycle:
+** If the GC used more than its target share of the time since the last cycle, the heap grows faster (fewer collections), else slower.
+** If gc_context_t.heap_limit is set, an allocation which would exceed it forces a full collection and fails (gc_objalloc returns NULL)
+** if the live heap is still too large.
+**
+** Allocation profiling:
+** If gc_context_t.prof_interval is set, allocations are sampled on average once every prof_interval bytes.
+** The distance to the next sample is drawn from an exponential distribution, so an allocation of s bytes is sampled with
+** probability 1-exp(-s/prof_interval) and each sample is weighted with the inverse, which makes the totals unbiased estimates.
+** A sample is attributed to the allocation site published in gc_context_t.prof_site (the VM publishes the bytecode offset
+** of the allocating instruction at safepoints). Sampled objects are tracked until they're released, so each site reports
+** allocated and live bytes. gc_prof_dump writes the sites in the folded stack format, which flame graph tools and pprof read.
+** An allocation which is not sampled only pays for a subtraction.
+**
+** Parallel marking:
+** Stop-the-world collections are traced by gc_context_t.mark_threads threads, using per-thread work stealing deques.
 */
 
 #define GC_DBG NEO_DBG /* Eanble GC debug mode and logging. */
 #define GC_LOADFACTOR 0.9 /* GC must be 90 % full before resizing. */
-#define GC_SWEEPFACTOR 0.5 /* Trigger a sweep when the number of allocations exceeds 50% of the maximum capacity. */
+#define GC_MIN_SLOTS 8 /* Minimum number of hashtable slots. Must be a power of two. */
+#define GC_SWEEPFACTOR 0.5 /* Heap growth factor: Trigger a collection when the heap grew by 50% since the last one. */
+#define GC_SWEEPFACTOR_MIN 0.1 /* Min heap growth factor of the feedback controller. */
+#define GC_SWEEPFACTOR_MAX 16.0 /* Max heap growth factor of the feedback controller. */
+#define GC_MIN_HEAP_BYTES (4ull<<20) /* Heap size in bytes, below which no collection is triggered by size. */
 #define GC_ALLOC_GRANULARITY 8 /* Allocation granularity. */
+#define GC_NURSERY_BLOCK_SIZE (32ull<<10) /* Size and alignment of a nursery bump block. Must be a power of two. */
+#define GC_NURSERY_MAX_GRANULES 31 /* Objects up to 248 bytes are bump allocated in the nursery (plus a granule header), larger ones are allocated individually. */
+#define GC_NURSERY_SPARE_MAX 4 /* Number of empty nursery blocks cached for reuse. */
+#define GC_NURSERY_LINE_SIZE 256 /* Size of a line inside a nursery block, holes for recycling are made of free lines. Must fit the largest nursery object and its header. */
+#define GC_NURSERY_LINES (GC_NURSERY_BLOCK_SIZE/GC_NURSERY_LINE_SIZE) /* Number of lines per nursery block. */
+#define GC_NURSERY_RECYCLE_MIN 16 /* Minimum number of free lines, for a nursery block to be recycled. */
+#define GC_LARGE_MIN_BYTES (64ull<<10) /* Objects of at least 64 KiB are allocated in their own page aligned span (large object space). */
+#define GC_LARGE_SPARE_MAX 8 /* Number of purged large object spans, which are cached for reuse. */
+#define GC_MINOR_THRESHOLD 4096 /* Number of young allocations which trigger a minor collection. */
+#define GC_STEP_INTERVAL 256 /* Number of allocations between two incremental marking steps. */
+#define GC_STEP_CLOCK_INTERVAL 32 /* Number of grey objects scanned between two clock reads. Must be a power of two. */
+#define GC_MARK_STACK_MAX (1<<20) /* Default max number of mark stack entries, the heap is rescanned if the stack overflows. */
+#define GC_MARK_PREFETCH 8 /* Number of popped objects, which are prefetched before they're scanned. Must be a power of two. */
+#define GC_SWEEP_BATCH 64 /* Number of pending dead objects, which are released by each allocation. */
+#define GC_MARKER_BATCH 256 /* Number of grey objects the background marker scans, before it releases the lock. */
+#define GC_PROF_INTERVAL (512ull<<10) /* Suggested mean sampling interval of the allocation profiler in bytes, cheap enough for production. */
+#define GC_STATS_HISTORY 16 /* Number of recent cycles whose stats are kept. Must be a power of two. */
+#define GC_CONCURRENT NEO_OS_POSIX /* Background marker thread support (requires pthreads). */
 #define gc_bytesize_isvalid(s) ((s)>=GC_ALLOC_GRANULARITY&&(s)<=GC_ALLOC_MAX&&(((s)&(GC_ALLOC_GRANULARITY-1))==0)) /* Is the size in bytes valid? */
 typedef uint32_t gc_grasize_t; /* Size of a memory allocation in granules. Each granule is 8 bytes large. So the smallest allocation in bytes is 8. */
 #define GC_ALLOC_MAX (~0u) /* Max allocation granules. */
@@ -73,16 +191,22 @@ typedef enum gc_flags_t {
     GCF_MARK = 1<<0,
     GCF_ROOT = 1<<1,
     GCF_LEAF = 1<<2,
+    GCF_OLD = 1<<3, /* Survived a collection, belongs to the old generation. Managed by the GC. */
+    GCF_NURSERY = 1<<4, /* Allocated inside a nursery block. Managed by the GC. */
+    GCF_REMEMBERED = 1<<5, /* Old object inside the remembered set. Managed by the GC. */
+    GCF_QUEUED = 1<<6, /* Dead object inside the finalization queue, kept alive until it's finalized. Managed by the GC. */
+    GCF_FINALIZED = 1<<7, /* Finalizer has run, the destructor hook is not called again. Managed by the GC. */
     GCF__MAX
 } gc_flags_t;
 neo_static_assert(GCF__MAX<=(1<<8)-1);
+#define GCF__MANAGED (GCF_OLD|GCF_NURSERY|GCF_REMEMBERED|GCF_QUEUED|GCF_FINALIZED) /* Flags owned by the GC, which can't be set or cleared by gc_objalloc or gc_set_flags. */
 typedef struct NEO_ALIGN(8) gc_fatptr_t {
     void *ptr;
     gc_grasize_t grasize; /* Size in granules. */
     gc_flags_t flags : 8; /* Flags. */
     uint32_t oid : 24; /* Object layout ID. */
     uint32_t hash; /* Hashcode. */
-    uint32_t reserved; /* Reserved. */
+    uint32_t span; /* Number of pages of the object's span inside the large object space, 0 for other objects. */
 } gc_fatptr_t;
 neo_static_assert(sizeof(gc_fatptr_t) == 24);
 neo_static_assert(offsetof(gc_fatptr_t, ptr) == 0);
@@ -91,22 +215,154 @@ neo_static_assert(offsetof(gc_fatptr_t, grasize) == 8);
 neo_static_assert(__alignof__(gc_fatptr_t) == 8);
 #endif
 
+struct gc_nursery_block_t;
+
+typedef struct gc_span_t { /* Page aligned memory span of the large object space. */
+    void *base;
+    size_t len; /* Length in bytes, a multiple of the page size. */
+} gc_span_t;
+struct gc_marker_t;
+struct gc_mark_pool_t;
+struct gc_layout_t;
+
+typedef enum gc_phase_t {
+    GC_PHASE_IDLE, /* No collection in progress. */
+    GC_PHASE_MARK /* Incremental marking in progress. */
+} gc_phase_t;
+
+typedef enum gc_trigger_t {
+    GC_TRIGGER_EXPLICIT, /* gc_collect, gc_collect_minor or gc_collect_step. */
+    GC_TRIGGER_ALLOC, /* Number of objects exceeded gc_context_t.threshold. */
+    GC_TRIGGER_YOUNG, /* Number of young objects exceeded gc_context_t.minor_threshold. */
+    GC_TRIGGER_BYTES, /* Heap size exceeded gc_context_t.byte_threshold. */
+    GC_TRIGGER_LIMIT /* Allocation would exceed gc_context_t.heap_limit. */
+} gc_trigger_t;
+
+/* Statistics of one collection cycle. All times are in microseconds (neo_hp_clock_us). */
+typedef struct gc_stats_t {
+    uint64_t id; /* Cycle number, starting at 1. */
+    gc_trigger_t trigger; /* Why the cycle was started. */
+    bool minor; /* Minor (young generation) collection? */
+    uint32_t pauses; /* Number of pauses (incremental steps), 1 for stop-the-world collections. */
+    uint64_t pause_us; /* Longest pause. */
+    uint64_t mark_us; /* Total marking time of all pauses. */
+    uint64_t sweep_us; /* Sweep time. */
+    size_t objects_before; /* Number of objects when the cycle started. */
+    size_t objects_after; /* Number of objects after the sweep. */
+    size_t bytes_before; /* Heap size in bytes when the cycle started. */
+    size_t bytes_after; /* Heap size in bytes after the sweep. */
+    size_t objects_freed; /* Number of reclaimed objects. */
+    size_t bytes_freed; /* Number of reclaimed bytes. */
+    size_t probes; /* Number of table slots inspected by the marker. */
+} gc_stats_t;
+
+/* Allocation site of the sampling profiler. Object and byte counts are estimates, scaled by the sampling probability. */
+typedef struct gc_prof_site_t {
+    uintptr_t site; /* Site published in gc_context_t.prof_site. */
+    size_t samples; /* Number of sampled allocations. */
+    size_t objects; /* Allocated objects. */
+    size_t bytes; /* Allocated bytes. */
+    size_t live_objects; /* Allocated objects, which are still alive. */
+    size_t live_bytes; /* Allocated bytes, which are still alive. */
+} gc_prof_site_t;
+struct gc_prof_obj_t;
+
 /* Per-thread GC context. */
 typedef struct gc_context_t {
     const void *stk; /* Bottom (start) of the VM stack. (VM stack grows upwards) */
     size_t stk_spdelta; /* VM Stack length (sp delta to stk). */
+    const void *stk_top; /* Live stack top (inclusive), published by the VM at safepoints. If NULL, the whole stack is scanned. */
     uintptr_t bndmin; /* Minimum pointer value of memory bounds. */
     uintptr_t bndmax; /* Maximum pointer value of memory bounds. */
-    gc_fatptr_t *trackedallocs; /* List of tracked allocated objects. */
-    size_t alloc_len; /* Allocated length of <trackedallocs>. */
-    gc_fatptr_t *freelist; /* Contains temporary freed objects. */
-    size_t free_len;
-    size_t slots; /* Number of slots in the hashtable. */
+    gc_fatptr_t *trackedallocs; /* Table of tracked objects, except nursery and large objects. */
+    size_t table_len; /* Number of objects in <trackedallocs>. */
+    size_t alloc_len; /* Number of all tracked objects (table, nursery and large object space). */
+    gc_fatptr_t *freelist; /* Dead objects, which are detached but not yet released (lazy sweeping). */
+    size_t free_len; /* Number of pending dead objects. */
+    size_t free_cap; /* Capacity of <freelist>, the buffer is kept across cycles. */
+    size_t slots; /* Number of slots in the hashtable. Always a power of two. */
+    uint32_t slot_shift; /* 64 - log2(slots), shift of the Fibonacci hash. */
     size_t threshold; /* Threshold value for triggering a garbage collection. */
     double loadfactor; /* Load-factor for triggering a resize. E.g., 0.75 means 75 % load of the table. */
-    double sweepfactor; /* Sweep-factor for triggering a sweep. */
+    double sweepfactor; /* Heap growth factor: The next collection is triggered when the heap grew by this factor. */
+    size_t byte_threshold; /* Heap size in bytes for triggering a garbage collection. */
+    size_t heap_limit; /* Hard heap limit in bytes (0 = unlimited). If an allocation would exceed it, a full collection is forced. If that is not enough, the allocation fails. */
+    double cpu_target; /* Target fraction of time spent in the GC (e.g. 0.05). If > 0, <sweepfactor> is adapted after each major cycle. */
+    double cpu_fraction; /* Smoothed fraction of time spent in the GC, measured by the controller. */
+    uint64_t cycle_end_us; /* End of the last major cycle. */
     volatile bool is_paused; /* Is the GC paused? */
     void (*dtor_hook)(void *); /* Destructor callback hook. */
+    bool finalize_deferred; /* Queue dead objects for gc_finalize instead of calling <dtor_hook> inside the sweep. */
+    void **finq; /* Finalization queue (FIFO). */
+    size_t finq_head; /* Next object to finalize. */
+    size_t finq_len; /* End of the finalization queue. */
+    size_t finq_cap; /* Capacity of <finq>. */
+    struct gc_nursery_block_t *nursery; /* Current nursery block, bump allocation happens here. */
+    struct gc_nursery_block_t *nursery_blocks; /* List of all nursery blocks, including the current one. */
+    size_t nursery_block_len; /* Number of blocks in <nursery_blocks>. */
+    struct gc_nursery_block_t *nursery_spare; /* List of cached empty nursery blocks. */
+    size_t nursery_spare_len; /* Number of cached empty nursery blocks. */
+    uintptr_t *nursery_set; /* Hashset of all nursery block addresses, to identify pointers into nursery blocks. */
+    size_t nursery_set_len; /* Number of blocks in <nursery_set>. */
+    size_t nursery_set_cap; /* Capacity of <nursery_set>. Always a power of two. */
+    uint8_t *bump_top; /* Bump pointer into the current nursery block. */
+    uint8_t *bump_end; /* End of the current nursery block or hole. */
+    struct gc_nursery_block_t *nursery_recycle; /* List of sparse blocks, whose holes are reused before new blocks are allocated. */
+    size_t nursery_line; /* Next line to search for holes, if the current block is recycled. */
+    bool nursery_recycling; /* Is the current block a recycled block? */
+    size_t nursery_pinned; /* Number of nursery objects with GCF_ROOT or GCF_QUEUED, the marker only walks the blocks for roots if nonzero. */
+    gc_fatptr_t resolved; /* Descriptor of the last nursery object returned by gc_resolve_ptr. */
+    gc_fatptr_t *large; /* Large objects, sorted by address. They're not inside the table. */
+    size_t large_len; /* Number of large objects. */
+    size_t large_cap; /* Capacity of <large>. */
+    gc_span_t large_spare[GC_LARGE_SPARE_MAX]; /* Purged spans of freed large objects, cached for reuse. */
+    size_t large_spare_len; /* Number of cached spans. */
+    size_t page_size; /* OS page size, alignment of large object spans. */
+    neo_memheap_t *heap; /* Private heap of individually allocated objects, freed at once by gc_free. NULL with the system allocator. */
+    neo_mempolicy_t mempolicy; /* Placement of the heap and large object spans, set from neo_mempolicy_get_default by gc_init. */
+    uint32_t numa_node; /* NUMA node of the thread which initialized the context. */
+    void **remset; /* Remembered set: Old objects which might reference young objects. */
+    size_t remset_len; /* Number of remembered objects. */
+    size_t remset_cap; /* Capacity of <remset>. */
+    size_t young_len; /* Number of young objects, allocated since the last collection. */
+    size_t minor_threshold; /* Number of young objects which trigger a minor collection. */
+    bool generational; /* Enable automatic minor collections. Requires all mutators to use gc_write_barrier. */
+    bool minor; /* Is a minor collection in progress? */
+    gc_phase_t phase; /* Current phase of the incremental collector. */
+    uint32_t pause_target_us; /* Max duration of an incremental marking step in microseconds. If 0, collections stop the world. */
+    const void **grey; /* Mark stack (grey worklist): Marked objects, whose children are not yet scanned. */
+    size_t grey_len; /* Number of grey objects. */
+    size_t grey_cap; /* Capacity of <grey>. */
+    size_t mark_stack_max; /* Max capacity of <grey>. */
+    bool mark_overflow; /* Did the mark stack overflow? Marked objects are rescanned after draining the stack. */
+    size_t step_allocs; /* Number of allocations since the last incremental step. */
+    size_t steps; /* Number of steps of the current (or last) incremental cycle. */
+    bool concurrent; /* Trace on a background marker thread, which is started by the first cycle. */
+    struct gc_marker_t *marker; /* Background marker thread, or NULL. */
+    uint32_t mark_threads; /* Number of threads which trace stop-the-world collections, including the collecting thread. 0 or 1 marks sequentially. */
+    struct gc_mark_pool_t *mark_pool; /* Parallel mark workers, or NULL. */
+    size_t alloc_bytes; /* Heap size: Total bytes of all tracked objects. */
+    size_t probes; /* Total number of table slots inspected by the marker. */
+    uint64_t cycles; /* Number of finished cycles. */
+    gc_stats_t cycle; /* Stats of the current (or last) cycle. */
+    gc_stats_t history[GC_STATS_HISTORY]; /* Ring buffer of the stats of recent cycles, indexed by (id-1)%GC_STATS_HISTORY. */
+    void (*stats_hook)(const gc_stats_t *); /* Optional callback, invoked after each cycle. */
+    size_t prof_interval; /* Mean number of allocated bytes between two samples of the allocation profiler. 0 disables profiling. */
+    size_t prof_countdown; /* Number of bytes until the next sample, 0 if not drawn yet. */
+    uint64_t prof_rng; /* State of the sampling PRNG (xorshift64*), must not be 0. */
+    uintptr_t prof_site; /* Current allocation site, published by the mutator. */
+    const char *(*prof_symbolize)(uintptr_t site); /* Optional: Name of the function containing a site, used by gc_prof_dump. May return NULL. */
+    gc_prof_site_t *prof_sites; /* Sampled allocation sites, in order of their first sample. */
+    size_t prof_sites_len; /* Number of sites. */
+    size_t prof_sites_cap; /* Capacity of <prof_sites>. */
+    uint32_t *prof_index; /* Hash index of <prof_sites> (site index + 1, 0 is empty). */
+    size_t prof_index_cap; /* Capacity of <prof_index>. Always a power of two. */
+    struct gc_prof_obj_t *prof_objs; /* Hash set of sampled objects, which are still alive. */
+    size_t prof_objs_len; /* Number of sampled live objects. */
+    size_t prof_objs_cap; /* Capacity of <prof_objs>. Always a power of two. */
+    struct gc_layout_t *layouts; /* Registered object layouts, indexed by object ID - 1. */
+    uint32_t layout_len; /* Number of registered layouts. */
+    uint32_t layout_cap; /* Capacity of <layouts>. */
 } gc_context_t;
 
 extern NEO_EXPORT void gc_init(gc_context_t *self, const void *stk, size_t stk_spdelta);
@@ -114,11 +370,23 @@ extern NEO_EXPORT void gc_free(gc_context_t *self);
 extern NEO_EXPORT void gc_pause(gc_context_t *self);
 extern NEO_EXPORT void gc_resume(gc_context_t *self);
 extern NEO_EXPORT NEO_HOTPROC void gc_collect(gc_context_t *self);
-extern NEO_EXPORT gc_fatptr_t *gc_resolve_ptr(gc_context_t *self, const void *ptr);
-extern NEO_EXPORT NEO_HOTPROC void *gc_objalloc(gc_context_t *self, gc_grasize_t size, gc_flags_t flags);
+extern NEO_EXPORT NEO_HOTPROC void gc_collect_minor(gc_context_t *self); /* Collect only the young generation. */
+extern NEO_EXPORT bool gc_collect_step(gc_context_t *self); /* Perform one incremental marking step, starts a new cycle if none is in progress. Returns true if the cycle finished. */
+extern NEO_EXPORT size_t gc_finalize(gc_context_t *self, size_t n); /* Run up to n queued finalizers (dtor_hook) on the calling thread. Returns the number of finalized objects. */
+extern NEO_EXPORT void gc_write_barrier(gc_context_t *self, void *obj, const void *old); /* Must be called before a reference inside obj is overwritten, old is the overwritten reference (or NULL). */
+extern NEO_EXPORT void gc_store_ref(gc_context_t *self, void *obj, void **slot, void *val); /* Store reference val into the slot of obj with gc_write_barrier. The store is atomic, so it doesn't race with the concurrent marker. */
+extern NEO_EXPORT bool gc_get_stats(gc_context_t *self, size_t age, gc_stats_t *out); /* Copy stats of a recent cycle, age 0 is the last finished cycle. Returns false if the cycle is not in the history. */
+extern NEO_EXPORT size_t gc_prof_get_sites(gc_context_t *self, gc_prof_site_t *out, size_t cap); /* Copy up to cap allocation sites of the profiler. Returns the total number of sites. */
+extern NEO_EXPORT size_t gc_prof_dump(gc_context_t *self, FILE *f, bool live); /* Write allocated (or live) bytes per site in folded stack format. Returns the number of written sites. */
+extern NEO_EXPORT void gc_prof_reset(gc_context_t *self); /* Drop all samples. */
+extern NEO_EXPORT gc_fatptr_t *gc_resolve_ptr(gc_context_t *self, const void *ptr); /* Nursery objects resolve to a copy of their header, which is overwritten by the next call. Use gc_set_flags to modify flags. */
+extern NEO_EXPORT NEO_HOTPROC void *gc_objalloc(gc_context_t *self, gc_grasize_t size, gc_flags_t flags); /* Returns NULL if gc_context_t.heap_limit is exceeded. */
+extern NEO_EXPORT NEO_HOTPROC void *gc_objalloc_typed(gc_context_t *self, gc_grasize_t size, gc_flags_t flags, uint32_t oid); /* Allocate object with a registered layout, oid 0 is scanned conservatively. */
+extern NEO_EXPORT uint32_t gc_layout_register(gc_context_t *self, const uint64_t *refmap, gc_grasize_t len); /* Register layout of <len> granules, bit i of refmap is set if granule i is a reference. Returns the object ID. */
 extern NEO_EXPORT void gc_objfree(gc_context_t *self, void *ptr);
 extern NEO_EXPORT void gc_set_flags(gc_context_t *self, void *ptr, gc_flags_t flags);
 extern NEO_EXPORT gc_flags_t gc_get_flags(gc_context_t *self, void *ptr);
+extern NEO_EXPORT uint32_t gc_get_oid(gc_context_t *self, void *ptr);
 extern NEO_EXPORT gc_grasize_t gc_get_size(gc_context_t *self, void *ptr);
 
 #ifdef __cplusplus
@@ -5,12 +5,34 @@
 
 #include <math.h>
 
+#if NEO_OS_WINDOWS
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#endif
+
+/* Stack length in bytes, rounded up to whole pages. */
+static size_t stk_map_len(const opstck_t *self) {
+    size_t ps = neo_osi->page_size ? neo_osi->page_size : 0x1000;
+    return (self->len*sizeof(*self->p)+ps-1)&~(ps-1);
+}
+
 void stk_alloc(opstck_t *self, size_t bsize, size_t bwarmup) {
     neo_dassert(self != NULL, "self is NULL");
     bsize = bsize && bsize % sizeof(record_t) == 0 ? bsize : VMSTK_DEF_SIZE;
     bwarmup = bwarmup && bwarmup % sizeof(record_t) == 0 ? bwarmup : VMSTK_DEF_WARMUP;
     self->len = bsize>>3; /* Bytes to record count -> / sizeof(record_t) */
-    self->p = neo_memalloc(NULL, bsize); /* Todo: use mmap/VirtualAlloc. */
+    size_t len = stk_map_len(self);
+    /* The stack is mapped directly, so its pages are untouched and not shared with other allocations when the policy is applied. */
+#if NEO_OS_WINDOWS
+    self->p = VirtualAlloc(NULL, len, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+#else
+    self->p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    self->p = self->p == MAP_FAILED ? NULL : self->p;
+#endif
+    neo_assert(self->p != NULL, "Failed to map VM stack: %zub", len);
+    neo_mempolicy_t policy = neo_mempolicy_get_default();
+    if (policy) { neo_osi_mem_policy(self->p, len, policy, neo_osi_numa_node()); } /* Before the warmup touches the pages. */
     memset(self->p, 0, bwarmup); /* Warmup region, preallocate pages. */
 }
 
@@ -19,7 +41,12 @@ void stk_free(opstck_t *self, bool poison) {
     if (poison) {
         memset(self->p, 0, self->len*sizeof(*self->p));
     }
-    neo_memalloc(self->p, 0);
+#if NEO_OS_WINDOWS
+    VirtualFree(self->p, 0, MEM_RELEASE);
+#else
+    munmap(self->p, stk_map_len(self));
+#endif
+    self->p = NULL;
 }
 
 void vm_init(vm_isolate_t **self, const char *name) {
@@ -43,6 +70,7 @@ void vm_init(vm_isolate_t **self, const char *name) {
     (**self).id ^= (int64_t)((tid >> 32) | (tid & ~(uint32_t)0)); /* Mix in thread ID. */
     stk_alloc(&(**self).stack, VMSTK_DEF_SIZE, VMSTK_DEF_WARMUP); /* Allocate stack. */
     gc_init(&(**self).gc_context, (**self).stack.p, (**self).stack.len);
+    (**self).gc_context.stk_top = (**self).stack.p; /* Empty stack, only the padding record. */
     (**self).io_input = stdin;
     (**self).io_output = stdout;
     (**self).io_error = stderr;
@@ -75,8 +103,6 @@ void vm_free(vm_isolate_t **self) {
 #   define label_ref(op)
 #endif
 
-#define STK_PADD_MAGIC (~(uint64_t)0)
-
 #define stk_check_ov(n)\
     if (neo_unlikely((uintptr_t)(sp+(n))>spe)) {\
         vif = VMINT_STK_OVERFLOW;/* Stack overflow occurred, abort. */\
@@ -311,12 +337,18 @@ neo_float_t prng_next_f64(prng_state_t *self) {
     }\
     pop(1)
 
+/*
+** Divisors 0 and -1 are the only ones which need special treatment, (uint)d+1 <= 1 catches both with a single compare.
+** So the hot path only pays one compare and branch, the slow path checks for zero division and INT_MIN / -1 overflow.
+*/
 #define z_op(op, ev)\
-    if (neo_unlikely(pint(0) == 0)) { /* Check for zero divison. */\
-        vif = VMINT_ARI_ZERODIV;\
-        goto exit;\
-    } else if (neo_unlikely(pint(-1) == NEO_INT_MIN && pint(0) == -1)) { /* Check for overflow. */\
-        pint(-1) = (ev);\
+    if (neo_unlikely((neo_uint_t)pint(0)+1 <= 1)) {\
+        if (pint(0) == 0) { /* Check for zero divison. */\
+            vif = VMINT_ARI_ZERODIV;\
+            goto exit;\
+        }\
+        pint(-1) = neo_unlikely(pint(-1) == NEO_INT_MIN) ? (ev) : pint(-1) op -1; /* Check for overflow. */\
+        pop(1);\
     } else {\
         bin_int_op(op);\
     }
@@ -385,6 +417,13 @@ neo_static_assert(sizeof(syscall_table)/sizeof(*syscall_table) == SYSCALL__LEN &
 
 #undef impl_syscall
 
+bool vm_syscall(vm_isolate_t *self, syscall_t id, record_t *sp) {
+    neo_dassert(self != NULL && sp != NULL, "self and sp must not be NULL");
+    neo_assert(id < SYSCALL__LEN, "Invalid syscall index: %d", (int)id);
+    self->gc_context.stk_top = sp; /* Safepoint: System calls might allocate and trigger a collection. */
+    return (*syscall_table[id])(self, sp);
+}
+
 /* ---- Core VM Impl (Hot code) ---- */
 
 NEO_HOTPROC bool vm_exec(vm_isolate_t *self, const bytecode_t *bcode) {
@@ -462,12 +501,14 @@ NEO_HOTPROC bool vm_exec(vm_isolate_t *self, const bytecode_t *bcode) {
         umm24_t call_id = bci_mod1unpack_umm24(*ip);
         int32_t depth = (int32_t)syscall_depths[call_id];
         stk_check_ov(depth); /* Check for stack overflow. */
-        stk_check_uv(depth); /* Check for stack underflow. */
+        stk_check_uv((int32_t)syscall_stack_ops[call_id]-1); /* Check for stack underflow, the syscall consumes sp[0] and below. */
+        self->gc_context.stk_top = sp; /* Safepoint: System calls might allocate and trigger a collection. */
+        self->gc_context.prof_site = (uintptr_t)(ip-(const bci_instr_t *)ipb); /* Allocation site for the profiler. */
         if (neo_unlikely((*syscall_table[call_id])(self, sp))) {
             vif = VMINT_SYS_SYSCALL; /* System call failed, abort. */
             goto exit; /* System call failed, abort. */
         }
-        sp -= depth; /* Pop depth delta. */
+        sp += depth; /* Apply depth delta. */
     }
     dispatch()
 
@@ -512,7 +553,8 @@ NEO_HOTPROC bool vm_exec(vm_isolate_t *self, const bytecode_t *bcode) {
     dispatch()
 
     decl_op(POP) /* Pop one stack record. */
-        pop(1);
+        stk_check_uv(0) /* Stack must not be empty. pop(n) requires n+1 records, which only holds for binary ops. */
+        --sp;
     dispatch()
 
     decl_op(LDC) /* Load constant from constant pool. */
@@ -582,17 +624,18 @@ NEO_HOTPROC bool vm_exec(vm_isolate_t *self, const bytecode_t *bcode) {
     dispatch()
 
     decl_op(ISLR) /* Integer bitwise logical right shift. */
-        pint(-1) = (neo_int_t)((neo_uint_t)pint(-1) >> puint(0));
+        pint(-1) = (neo_int_t)((neo_uint_t)pint(-1) >> (puint(0) & 63));
         pop(1);
     dispatch()
 
     decl_op(IROL) /* Integer bitwise arithmetic left rotation. */
         pint(-1) = (neo_int_t)neo_rol64((neo_uint_t)pint(-1), puint(0) & 63);
-    pop(1);
+        pop(1);
     dispatch()
 
     decl_op(IROR) /* Integer bitwise arithmetic right rotation. */
         pint(-1) = (neo_int_t)neo_ror64((neo_uint_t)pint(-1), puint(0) & 63);
+        pop(1);
     dispatch()
 
 #ifndef NEO_VM_COMPUTED_GOTO /* To suppress enumeration value ‘OPC__**’ not handled in switch [-Werror=switch]. */
@@ -606,6 +649,7 @@ exit:
     self->rstate.interrupt = vif;
     self->rstate.ip = ip;
     self->rstate.sp = sp;
+    self->gc_context.stk_top = sp; /* Publish live stack top, so the GC only scans [stack.p, sp]. */
     self->rstate.ip_delta = ip-(const bci_instr_t *)ipb;
     self->rstate.sp_delta = sp-(const record_t *)spb;
     ++self->rstate.invocs;
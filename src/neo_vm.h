@@ -22,6 +22,7 @@ typedef struct opstck_t {
 #define VMSTK_DEF_SIZE (1024ull*1024ull*1ull) /* Default stack size: 1 MB. Must be a multiple of 8 */
 #define VMSTK_DEF_ELEMTS (VMSTK_DEF_SIZE>>3) /* Default stack element count.  */
 #define VMSTK_DEF_WARMUP 0x4000 /* 16 KiB Warmup region in bytes [SP, SP+0x4000]. Must be a multiple of 8 */
+#define STK_PADD_MAGIC (~(uint64_t)0) /* Value of the padding record at stack[0], the first pushed record lives at stack[1]. */
 neo_static_assert(sizeof(record_t) == 8 && VMSTK_DEF_SIZE % sizeof(record_t) == 0);
 neo_static_assert(VMSTK_DEF_WARMUP % sizeof(record_t) == 0);
 extern NEO_EXPORT void stk_alloc(opstck_t *self, size_t bsize, size_t bwarmup); /* Len = stack size in bytes. Must be a multiple of 8. Warmup = bwarmup region in bytes. Must be a multiple of 8 */
@@ -30,9 +31,9 @@ extern NEO_EXPORT void stk_free(opstck_t *self, bool poison);
 /* ---- VM-Intrinsic routines. ---- */
 
 extern NEO_HOTPROC neo_uint_t vmop_upow64_no_ov(neo_uint_t x, neo_uint_t k); /* Unsigned r = x ^ k. o overflow checks. */
-extern NEO_HOTPROC neo_int_t vmop_ipow64_no_ov(neo_int_t x, neo_int_t k); /* Signed r = x ^ k. No overflow checks. */
+extern NEO_EXPORT NEO_HOTPROC neo_int_t vmop_ipow64_no_ov(neo_int_t x, neo_int_t k); /* Signed r = x ^ k. No overflow checks. Called by transpiled code. */
 extern NEO_HOTPROC bool vmop_upow64(neo_uint_t x, neo_uint_t k, neo_uint_t *r); /* Signed r = x ^ k. Return true on overflow. */
-extern NEO_HOTPROC bool vmop_ipow64(neo_int_t x, neo_int_t k, neo_int_t *r); /* Signed r = x ^ k. Return true on overflow. */
+extern NEO_EXPORT NEO_HOTPROC bool vmop_ipow64(neo_int_t x, neo_int_t k, neo_int_t *r); /* Signed r = x ^ k. Return true on overflow. Called by transpiled code. */
 extern NEO_HOTPROC neo_float_t vmop_ceil(neo_float_t x); /* Ceil(x). */
 extern NEO_HOTPROC neo_float_t vmop_floor(neo_float_t x); /* Floor(x). */
 extern NEO_HOTPROC neo_float_t vmop_mod(neo_float_t x, neo_float_t y); /* x % y. */
@@ -84,6 +85,7 @@ struct vm_isolate_t {
 extern NEO_EXPORT void vm_init(vm_isolate_t **self, const char *name);
 extern NEO_EXPORT void vm_free(vm_isolate_t **self);
 extern NEO_HOTPROC NEO_NODISCARD NEO_EXPORT bool vm_exec(vm_isolate_t *self, const bytecode_t *bcode);
+extern NEO_NODISCARD NEO_EXPORT bool vm_syscall(vm_isolate_t *self, syscall_t id, record_t *sp); /* Invoke system call with sp pointing to the top stack record. Returns true on failure. Used by transpiled code (see bc_transpile_c99). */
 
 #ifdef __cplusplus
 }
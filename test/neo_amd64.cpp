@@ -1,5 +1,7 @@
 // (c) Copyright Mario "Neo" Sieg 2023. All rights reserved. mario.sieg.64@gmail.com
 
+#include <fstream>
+#include <sstream>
 #include <gtest/gtest.h>
 #include <neo_amd64.h>
 #include <Zydis/Zydis.h>
@@ -111,3 +113,33 @@ TEST(amd64, emit_alu_reg_imm64) {
     ASSERT_EQ(instructions.size(), 1);
 }
 #endif
+
+#if NEO_OS_LINUX
+
+TEST(amd64, perfmap_register) {
+    constexpr auto len = 64;
+    mcode_t buf[len] {};
+    mcode_t *p = buf+len;
+    mov_ri(&p, RID_RAX, (imm_t) {
+        .u64 = 10
+    });
+    auto size = static_cast<std::size_t>(buf+len-p);
+    ASSERT_TRUE(perfmap_register(p, size, "Test", "perfmap"));
+    ASSERT_TRUE(perfmap_register(p, size, nullptr, "main"));
+    char path[64];
+    std::snprintf(path, sizeof(path), PERFMAP_PATH_FMT, static_cast<int>(getpid()));
+    std::ifstream f {path};
+    ASSERT_TRUE(f.is_open());
+    std::vector<std::string> lines {};
+    for (std::string line {}; std::getline(f, line);) {
+        lines.emplace_back(line);
+    }
+    ASSERT_GE(lines.size(), 2);
+    std::ostringstream sym {};
+    sym << std::hex << reinterpret_cast<std::uintptr_t>(p) << ' ' << size << ' ';
+    ASSERT_EQ(lines[lines.size()-2], sym.str() + "Test.perfmap");
+    ASSERT_EQ(lines[lines.size()-1], sym.str() + "main");
+    std::remove(path);
+}
+
+#endif
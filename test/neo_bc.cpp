@@ -1,7 +1,17 @@
 // (c) Copyright Mario "Neo" Sieg 2023. All rights reserved. mario.sieg.64@gmail.com
 
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include <neo_bc.h>
+#include <neo_vm.h>
+
+#if NEO_OS_LINUX || NEO_OS_BSD || NEO_OS_OSX
+#   include <dlfcn.h>
+#endif
 
 TEST(bytecode, append) {
     bytecode_t bc {};
@@ -116,4 +126,139 @@ TEST(bytecode, stack_depths) {
     ASSERT_EQ(opc_depths[OPC_HLT], 0);
     ASSERT_EQ(opc_depths[OPC_IPUSH], 1);
     ASSERT_EQ(opc_depths[OPC_POP], -1);
-}
\ No newline at end of file
+}
+
+static std::string transpile_c99(const bytecode_t *bc, const char *name) {
+    FILE *f {tmpfile()};
+    EXPECT_NE(f, nullptr);
+    bc_transpile_c99(bc, f, name);
+    std::string src {};
+    src.resize(static_cast<std::size_t>(ftell(f)));
+    rewind(f);
+    EXPECT_EQ(fread(src.data(), 1, src.size(), f), src.size());
+    fclose(f);
+    return src;
+}
+
+TEST(bytecode, transpile_c99) {
+    bytecode_t bc {};
+    bc_init(&bc);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_NOP));
+    bc_emit_ipush(&bc, NEO_INT_MAX);
+    bc_emit_ipush(&bc, 2);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_IADD));
+    bc_emit(&bc, bci_comp_mod1_umm24(OPC_SYSCALL, SYSCALL_PRINT_INT));
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_IAND)); /* Stack underflow, detected statically. */
+    bc_finalize(&bc);
+    const std::string src {transpile_c99(&bc, "test_main")};
+    ASSERT_NE(src.find("#include \"neo_vm.h\""), std::string::npos);
+    ASSERT_NE(src.find("NEO_HOTPROC bool test_main(vm_isolate_t *self) {"), std::string::npos);
+    ASSERT_NE(src.find("static const record_t test_main_pool[1] = {"), std::string::npos);
+    ASSERT_NE(src.find("sp[1] = test_main_pool[0];"), std::string::npos);
+    ASSERT_NE(src.find("sp[2].as_int = 2;"), std::string::npos);
+    ASSERT_NE(src.find("__builtin_add_overflow(sp[1].as_int, sp[2].as_int, &sp[1].as_int)"), std::string::npos);
+    ASSERT_NE(src.find("vm_syscall(self, SYSCALL_PRINT_INT, sp+1)"), std::string::npos);
+    ASSERT_NE(src.find("vif = VMINT_STK_UNDERFLOW; ip = 5; d = 0;"), std::string::npos);
+    ASSERT_EQ(src.find("vif = VMINT_OK;", src.find("VMINT_STK_UNDERFLOW")), std::string::npos); /* Code after the underflow is unreachable. */
+    ASSERT_NE(src.find("if (neo_unlikely(self->stack.len < 3))"), std::string::npos); /* One overflow check per new maximum depth. */
+    ASSERT_EQ(src.find("if (neo_unlikely(self->stack.len < 4))"), std::string::npos);
+    bc_free(&bc);
+}
+
+#if NEO_OS_LINUX || NEO_OS_BSD || NEO_OS_OSX
+TEST(bytecode, transpile_c99_matches_vm_exec) { /* Compiles the generated code with the system C compiler and compares the result state with vm_exec. */
+    if (std::system("cc --version > /dev/null 2>&1") != 0) {
+        GTEST_SKIP() << "No system C compiler";
+    }
+    std::vector<std::vector<bci_instr_t>> progs {
+        { /* Arithmetic, shifts and rotations, ends with a deep stack. */
+            bci_comp_mod1_imm24(OPC_IPUSH, 3),
+            bci_comp_mod1_imm24(OPC_IPUSH, 5),
+            bci_comp_mod1_no_imm(OPC_IPOW),
+            bci_comp_mod1_imm24(OPC_IPUSH, -7),
+            bci_comp_mod1_no_imm(OPC_IMUL),
+            bci_comp_mod1_imm24(OPC_IPUSH, 4),
+            bci_comp_mod1_no_imm(OPC_IDIV),
+            bci_comp_mod1_no_imm(OPC_IPUSHM1),
+            bci_comp_mod1_imm24(OPC_IPUSH, 65),
+            bci_comp_mod1_no_imm(OPC_ISLR), /* Shift amount is masked to 63. */
+            bci_comp_mod1_no_imm(OPC_IPUSHM1),
+            bci_comp_mod1_imm24(OPC_IPUSH, 70),
+            bci_comp_mod1_no_imm(OPC_ISAR),
+            bci_comp_mod1_imm24(OPC_IPUSH, 0x1234),
+            bci_comp_mod1_imm24(OPC_IPUSH, 12),
+            bci_comp_mod1_no_imm(OPC_IROL),
+            bci_comp_mod1_imm24(OPC_IPUSH, 7),
+            bci_comp_mod1_no_imm(OPC_IROR),
+            bci_comp_mod1_imm24(OPC_IPUSH, -9),
+            bci_comp_mod1_imm24(OPC_IPUSH, 4),
+            bci_comp_mod1_no_imm(OPC_IMOD),
+            bci_comp_mod1_no_imm(OPC_IXOR),
+            bci_comp_mod1_no_imm(OPC_FPUSH05),
+            bci_comp_mod1_no_imm(OPC_POP),
+        },
+        { /* Overflow in checked addition. */
+            bci_comp_mod1_imm24(OPC_IPUSH, 1),
+            bci_comp_mod1_no_imm(OPC_IPUSHM1),
+            bci_comp_mod1_imm24(OPC_IPUSH, 63),
+            bci_comp_mod1_no_imm(OPC_ISLR),
+            bci_comp_mod1_no_imm(OPC_IADD),
+        },
+        { /* Division by zero. */
+            bci_comp_mod1_imm24(OPC_IPUSH, 7),
+            bci_comp_mod1_no_imm(OPC_IPUSH0),
+            bci_comp_mod1_no_imm(OPC_IMOD),
+        },
+        { /* Stack underflow. */
+            bci_comp_mod1_imm24(OPC_IPUSH, 7),
+            bci_comp_mod1_no_imm(OPC_IAND),
+        },
+    };
+    std::vector<bytecode_t> bcs {progs.size()};
+    std::string src {};
+    for (std::size_t i {}; i < progs.size(); ++i) {
+        bc_init(&bcs[i]);
+        bc_emit(&bcs[i], bci_comp_mod1_no_imm(OPC_NOP));
+        for (bci_instr_t ins : progs[i]) {
+            bc_emit(&bcs[i], ins);
+        }
+        bc_finalize(&bcs[i]);
+        src += transpile_c99(&bcs[i], ("prog" + std::to_string(i)).c_str());
+    }
+    const std::string dir {testing::TempDir()};
+    const std::string c {dir + "neo_transpile_test.c"};
+    const std::string so {dir + "neo_transpile_test.so"};
+    FILE *f {fopen(c.c_str(), "wb")};
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(fwrite(src.data(), 1, src.size(), f), src.size());
+    fclose(f);
+    const std::string cmd {"cc -std=gnu99 -O2 -fPIC -shared -I src -o " + so + " " + c};
+    ASSERT_EQ(std::system(cmd.c_str()), 0) << src;
+    void *lib {dlopen(so.c_str(), RTLD_NOW|RTLD_LOCAL)};
+    ASSERT_NE(lib, nullptr) << dlerror();
+
+    for (std::size_t i {}; i < progs.size(); ++i) {
+        auto *fn {reinterpret_cast<bool (*)(vm_isolate_t *)>(dlsym(lib, ("prog" + std::to_string(i)).c_str()))};
+        ASSERT_NE(fn, nullptr);
+        vm_isolate_t *interp {};
+        vm_isolate_t *native {};
+        vm_init(&interp, "interp");
+        vm_init(&native, "native");
+        ASSERT_TRUE(bc_validate(&bcs[i], interp));
+        const bool ok {vm_exec(interp, &bcs[i])};
+        ASSERT_EQ(fn(native), ok);
+        ASSERT_EQ(native->rstate.interrupt, interp->rstate.interrupt);
+        ASSERT_EQ(native->rstate.ip_delta, interp->rstate.ip_delta);
+        ASSERT_EQ(native->rstate.sp_delta, interp->rstate.sp_delta);
+        for (ptrdiff_t j {1}; j <= interp->rstate.sp_delta; ++j) {
+            ASSERT_EQ(native->stack.p[j].ru64, interp->stack.p[j].ru64) << "program " << i << ", record " << j;
+        }
+        vm_free(&native);
+        vm_free(&interp);
+        bc_free(&bcs[i]);
+    }
+    ASSERT_EQ(dlclose(lib), 0);
+    std::remove(c.c_str());
+    std::remove(so.c_str());
+}
+#endif
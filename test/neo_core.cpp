@@ -4,6 +4,9 @@
 #include <neo_lexer.h>
 #include <neo_core.h>
 #include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 TEST(core, bundled_alloc_vs_malloc_bench) {
     std::vector<std::size_t> block_sizes {};
@@ -88,6 +91,130 @@ TEST(core, neo_reallocate_aligned) {
     neo_allocator_free(p);
 }
 
+TEST(core, neo_heap_free_all) {
+    neo_memheap_t *heap = neo_allocator_heap_acquire();
+    ASSERT_NE(heap, nullptr);
+    for (int round = 0; round < 2; ++round) {
+        std::vector<std::uint8_t *> blocks {};
+        for (std::size_t i = 0; i < 1024; ++i) {
+            std::size_t len = 8+(i*37)%(i & 1 ? 200000 : 4096);
+            auto *p = static_cast<std::uint8_t *>(neo_allocator_heap_alloc(heap, len));
+            ASSERT_NE(p, nullptr);
+            std::memset(p, 0xab, len);
+            blocks.emplace_back(p);
+        }
+        for (std::size_t i = 0; i < blocks.size(); i += 3) {
+            neo_allocator_free(blocks[i]);
+        }
+        neo_allocator_heap_free_all(heap);
+    }
+    neo_allocator_heap_release(heap);
+}
+
+TEST(core, neo_mempolicy) {
+    neo_osi_init();
+    ASSERT_GE(neo_osi->numa_nodes, 1);
+    ASSERT_GT(neo_osi->huge_page_size, 0);
+    ASSERT_LT(neo_osi_numa_node(), neo_osi->numa_nodes);
+    std::size_t len = neo_osi->huge_page_size*2;
+    auto *p = static_cast<std::uint8_t *>(neo_allocator_alloc(len));
+    neo_osi_mem_policy(p, len, static_cast<neo_mempolicy_t>(NEO_MEMPOLICY_HUGE_PAGES|NEO_MEMPOLICY_NUMA_LOCAL), neo_osi_numa_node()); // Only a hint.
+    ASSERT_FALSE(neo_osi_mem_policy(p, 1, NEO_MEMPOLICY_HUGE_PAGES, 0)); // No whole page.
+    std::memset(p, 0xab, len);
+    ASSERT_EQ(p[len-1], 0xab);
+    neo_allocator_free(p);
+
+    neo_memheap_t *heap = neo_allocator_heap_acquire();
+    neo_allocator_heap_set_policy(heap, NEO_MEMPOLICY_HUGE_PAGES, 0);
+    p = static_cast<std::uint8_t *>(neo_allocator_heap_alloc(heap, len));
+    std::memset(p, 0xcd, len);
+    neo_allocator_heap_free_all(heap);
+    neo_allocator_heap_release(heap);
+
+    ASSERT_EQ(neo_mempolicy_get_default(), NEO_MEMPOLICY_DEFAULT);
+    neo_mempolicy_set_default(NEO_MEMPOLICY_NUMA_LOCAL);
+    ASSERT_EQ(neo_mempolicy_get_default(), NEO_MEMPOLICY_NUMA_LOCAL);
+    neo_mempolicy_set_default(NEO_MEMPOLICY_DEFAULT);
+}
+
+TEST(core, neo_mempolicy_huge_pages) {
+    neo_osi_init();
+    bool thp = false;
+    if (FILE *f = std::fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r")) { // e.g. "always [madvise] never"
+        char mode[128] {};
+        thp = std::fgets(mode, sizeof(mode), f) && !std::strstr(mode, "[never]");
+        std::fclose(f);
+    }
+    if (!thp) {
+        GTEST_SKIP() << "Transparent huge pages are not available";
+    }
+    const std::size_t hps = neo_osi->huge_page_size;
+    void *p = std::aligned_alloc(hps, 2*hps);
+    ASSERT_NE(p, nullptr);
+    ASSERT_TRUE(neo_osi_mem_policy(p, 2*hps, NEO_MEMPOLICY_HUGE_PAGES, neo_osi_numa_node()));
+    ASSERT_FALSE(neo_osi_mem_policy(p, hps/2, NEO_MEMPOLICY_HUGE_PAGES, neo_osi_numa_node())); // Smaller than a huge page.
+    ASSERT_FALSE(neo_osi_mem_policy(p, 2*hps, NEO_MEMPOLICY_DEFAULT, neo_osi_numa_node()));
+    std::free(p);
+}
+
+TEST(core, neo_allocator_stats) {
+    static constexpr std::size_t cls = 3;
+    neo_alloc_stats_t s0, s1, s2;
+    neo_allocator_stats(&s0);
+    ASSERT_EQ(s0.size_class[cls].block_size, 48);
+    ASSERT_GT(s0.mapped, 0);
+    std::vector<void *> blocks {};
+    for (std::size_t i = 0; i < 100; ++i) {
+        blocks.emplace_back(neo_allocator_alloc(48));
+    }
+    void *large = neo_allocator_alloc(200000);
+    void *huge = neo_allocator_alloc(16<<20);
+    neo_allocator_stats(&s1);
+    ASSERT_EQ(s1.size_class[cls].live, s0.size_class[cls].live+100);
+    ASSERT_EQ(s1.size_class[cls].alloc_total, s0.size_class[cls].alloc_total+100);
+    ASSERT_EQ(s1.large_live, s0.large_live+1);
+    ASSERT_EQ(s1.huge_live, s0.huge_live+1);
+    ASSERT_GE(s1.huge_bytes, s0.huge_bytes+(16<<20));
+    ASSERT_GE(s1.allocated, s0.allocated+100*48+200000+(16<<20));
+    ASSERT_GE(s1.mapped, s0.mapped+(16<<20));
+    ASSERT_GT(s1.map_calls, s0.map_calls);
+    ASSERT_GE(s1.alloc_calls, s0.alloc_calls+102);
+    for (void *p : blocks) {
+        neo_allocator_free(p);
+    }
+    neo_allocator_free(large);
+    neo_allocator_free(huge);
+    neo_allocator_stats(&s2);
+    ASSERT_EQ(s2.size_class[cls].live, s0.size_class[cls].live);
+    ASSERT_EQ(s2.size_class[cls].free_total, s0.size_class[cls].free_total+100);
+    ASSERT_EQ(s2.large_live, s0.large_live);
+    ASSERT_EQ(s2.huge_bytes, s0.huge_bytes);
+    ASSERT_EQ(s2.allocated, s0.allocated);
+    ASSERT_LE(s2.mapped, s1.mapped-(16<<20));
+    ASSERT_GT(s2.unmap_calls, s1.unmap_calls);
+
+    neo_memheap_t *heap = neo_allocator_heap_acquire();
+    blocks.clear();
+    for (std::size_t i = 0; i < 1000; ++i) {
+        blocks.emplace_back(neo_allocator_heap_alloc(heap, 48));
+    }
+    void *span = neo_allocator_heap_alloc(heap, 200000);
+    ASSERT_NE(span, nullptr);
+    for (std::size_t i = 0; i < blocks.size(); i += 3) {
+        neo_allocator_free(blocks[i]);
+    }
+    neo_allocator_stats(&s1);
+    ASSERT_EQ(s1.size_class[cls].live, s0.size_class[cls].live+1000-334);
+    ASSERT_EQ(s1.large_live, s0.large_live+1);
+    neo_allocator_heap_free_all(heap); // Dropped blocks count as freed.
+    neo_allocator_stats(&s2);
+    ASSERT_EQ(s2.size_class[cls].live, s0.size_class[cls].live);
+    ASSERT_EQ(s2.large_live, s0.large_live);
+    ASSERT_EQ(s2.allocated, s0.allocated);
+    ASSERT_GT(s2.span_cache_hits+s2.span_reserve_hits+s2.global_cache_hits+s2.span_cache_misses, 0);
+    neo_allocator_heap_release(heap);
+}
+
 TEST(core, float_fmt) {
     char buf[64] {};
     neo_fmt_float((uint8_t *)buf, 0.0);
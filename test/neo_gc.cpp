@@ -2,7 +2,13 @@
 
 #include <gtest/gtest.h>
 #include <neo_gc.h>
+#include <neo_vm.h>
+#include <array>
+#include <vector>
+#include <cstdlib>
 #include <cstring>
+#include <cstdio>
+#include <string>
 
 #if 0 /* TODO: fix segfault */
 
@@ -126,3 +132,784 @@ TEST(gc, gc_alloc_huge) {
 }
 
 #endif
+
+TEST(gc, nursery_bump_alloc) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+
+    auto *a = static_cast<std::uint8_t*>(gc_objalloc(&gc, 2, GCF_NONE));
+    stk[1] = reinterpret_cast<std::uintptr_t>(a);
+    auto *b = static_cast<std::uint8_t*>(gc_objalloc(&gc, 3, GCF_NONE));
+    stk[2] = reinterpret_cast<std::uintptr_t>(b);
+    ASSERT_EQ(b, a+gc_granules2bytes(2+1)); // bump allocated, after the header of b
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(a)&~(GC_NURSERY_BLOCK_SIZE-1), reinterpret_cast<std::uintptr_t>(b)&~(GC_NURSERY_BLOCK_SIZE-1));
+    ASSERT_TRUE(gc_get_flags(&gc, a) & GCF_NURSERY);
+    for (std::size_t i {}; i < gc_granules2bytes(3); ++i) {
+        ASSERT_EQ(b[i], 0);
+    }
+
+    void *large {gc_objalloc(&gc, GC_NURSERY_MAX_GRANULES+1, GCF_NONE)};
+    void *root {gc_objalloc(&gc, 1, GCF_ROOT)};
+    ASSERT_FALSE(gc_get_flags(&gc, large) & GCF_NURSERY);
+    ASSERT_FALSE(gc_get_flags(&gc, root) & GCF_NURSERY);
+
+    gc_set_flags(&gc, a, GCF_LEAF); // managed flags are preserved
+    ASSERT_TRUE(gc_get_flags(&gc, a) & GCF_LEAF);
+    ASSERT_TRUE(gc_get_flags(&gc, a) & GCF_NURSERY);
+
+    for (int i {}; i < 10000; ++i) { // spans many nursery blocks
+        gc_objalloc(&gc, 4, GCF_NONE);
+    }
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, 3); // a, b and the root survive
+    stk = {};
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, 1); // only the root survives
+    gc_objfree(&gc, root);
+    gc_free(&gc);
+}
+
+TEST(gc, minor_collection_promotes_survivors) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+
+    void *a {gc_objalloc(&gc, 1, GCF_NONE)};
+    void *b {gc_objalloc(&gc, 1, GCF_NONE)};
+    ASSERT_EQ(gc.young_len, 2);
+    stk[1] = reinterpret_cast<std::uintptr_t>(a);
+    gc_collect_minor(&gc);
+    ASSERT_EQ(free_count, 1); // b is garbage
+    ASSERT_EQ(gc_get_size(&gc, b), 0);
+    ASSERT_TRUE(gc_get_flags(&gc, a) & GCF_OLD);
+    ASSERT_EQ(gc.young_len, 0);
+
+    stk[1] = 0;
+    gc_collect_minor(&gc);
+    ASSERT_EQ(free_count, 1); // old objects survive minor collections
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 2);
+    ASSERT_EQ(gc.alloc_len, 0);
+    gc_free(&gc);
+}
+
+TEST(gc, write_barrier_remembered_set) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+
+    auto **old {static_cast<void**>(gc_objalloc(&gc, 1, GCF_NONE))};
+    stk[1] = reinterpret_cast<std::uintptr_t>(old);
+    gc_collect_minor(&gc);
+    ASSERT_TRUE(gc_get_flags(&gc, old) & GCF_OLD);
+
+    void *young {gc_objalloc(&gc, 1, GCF_NONE)};
+    gc_write_barrier(&gc, old, *old); // before the store
+    *old = young;
+    ASSERT_TRUE(gc_get_flags(&gc, old) & GCF_REMEMBERED);
+    ASSERT_EQ(gc.remset_len, 1);
+    gc_write_barrier(&gc, old, young); // already remembered
+    gc_write_barrier(&gc, young, nullptr); // young objects are not remembered
+    ASSERT_EQ(gc.remset_len, 1);
+
+    gc_collect_minor(&gc);
+    ASSERT_EQ(free_count, 0); // young is reachable through the remembered set
+    ASSERT_TRUE(gc_get_flags(&gc, young) & GCF_OLD);
+    ASSERT_FALSE(gc_get_flags(&gc, old) & GCF_REMEMBERED);
+    ASSERT_EQ(gc.remset_len, 0);
+
+    *old = nullptr;
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 1);
+    stk[1] = 0;
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 2);
+    gc_free(&gc);
+}
+
+TEST(gc, scan_live_stack_region) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+
+    void *live {gc_objalloc(&gc, 1, GCF_NONE)};
+    void *dead {gc_objalloc(&gc, 1, GCF_NONE)};
+    stk[2] = reinterpret_cast<std::uintptr_t>(live);
+    stk[5] = reinterpret_cast<std::uintptr_t>(dead); // stale slot above the stack top
+    gc.stk_top = &stk[2];
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 1);
+    ASSERT_EQ(gc_get_size(&gc, live), 1);
+    ASSERT_EQ(gc_get_size(&gc, dead), 0);
+
+    gc.stk_top = &stk[1];
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 2);
+    gc_free(&gc);
+}
+
+TEST(gc, side_bitmap_identifies_object_starts) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+
+    auto *parent {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 2, GCF_NONE))};
+    stk[0] = reinterpret_cast<std::uintptr_t>(parent);
+    void *child {gc_objalloc(&gc, 1, GCF_NONE)};
+    parent[1] = reinterpret_cast<std::uintptr_t>(child); // heap reference
+    auto *interior {static_cast<std::uint8_t *>(gc_objalloc(&gc, 4, GCF_NONE))};
+    stk[1] = reinterpret_cast<std::uintptr_t>(interior+8); // interior pointers don't keep objects alive
+    stk[2] = reinterpret_cast<std::uintptr_t>(interior+1); // neither do unaligned ones
+    ASSERT_TRUE(gc_get_flags(&gc, parent) & GCF_NURSERY);
+    ASSERT_TRUE(gc_get_flags(&gc, interior) & GCF_NURSERY);
+    ASSERT_EQ(gc.table_len, 0); // nursery objects are not inside the table
+
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 1);
+    ASSERT_EQ(gc_get_size(&gc, parent), 2);
+    ASSERT_EQ(gc_get_size(&gc, child), 1);
+    ASSERT_EQ(gc_get_size(&gc, interior), 0);
+
+    stk[3] = reinterpret_cast<std::uintptr_t>(interior); // dangling reference to the freed object
+    gc_collect(&gc); // marks were cleared by the previous sweep
+    ASSERT_EQ(free_count, 1);
+    ASSERT_EQ(gc_get_size(&gc, child), 1);
+    stk.fill(0);
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 3);
+    gc_free(&gc);
+}
+
+TEST(gc, incremental_marking_with_barrier) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+    gc_pause(&gc); // only explicit steps
+
+    constexpr std::size_t n {100000};
+    std::vector<std::uintptr_t *> nodes {};
+    for (std::size_t i {}; i < n; ++i) { // linked list: [0] = next, [1] = extra reference
+        auto *node {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 2, GCF_NONE))};
+        if (!nodes.empty()) nodes.back()[0] = reinterpret_cast<std::uintptr_t>(node);
+        nodes.push_back(node);
+    }
+    stk[0] = reinterpret_cast<std::uintptr_t>(nodes.front());
+    gc_objalloc(&gc, 1, GCF_NONE); // garbage
+
+    gc.pause_target_us = 1;
+    ASSERT_FALSE(gc_collect_step(&gc)); // list is too long to be traced within one step
+    ASSERT_EQ(gc.phase, GC_PHASE_MARK);
+    ASSERT_EQ(free_count, 0);
+
+    std::uintptr_t *head {nodes.front()}; // already scanned (black)
+    std::uintptr_t *tail {nodes.back()}; // not yet marked (white)
+    gc_store_ref(&gc, head, reinterpret_cast<void **>(head+1), tail);
+    gc_store_ref(&gc, nodes[n-2], reinterpret_cast<void **>(nodes[n-2]), nullptr); // tail is only reachable through head now, the barrier shades it
+    void *fresh {gc_objalloc(&gc, 1, GCF_NONE)}; // allocated black
+    ASSERT_TRUE(gc_resolve_ptr(&gc, fresh) != nullptr);
+
+    while (!gc_collect_step(&gc));
+    ASSERT_EQ(gc.phase, GC_PHASE_IDLE);
+    ASSERT_GT(gc.steps, 1);
+    ASSERT_EQ(free_count, 1);
+    ASSERT_EQ(gc_get_size(&gc, tail), 2);
+    ASSERT_EQ(gc_get_size(&gc, fresh), 1);
+
+    stk.fill(0);
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 1+n+1);
+    gc_free(&gc);
+}
+
+TEST(gc, concurrent_marking) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+    gc_pause(&gc);
+
+    constexpr std::size_t n {100000};
+    std::vector<std::uintptr_t *> nodes {};
+    for (std::size_t i {}; i < n; ++i) { // linked list: [0] = next, [1] = extra reference
+        auto *node {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 2, GCF_NONE))};
+        if (!nodes.empty()) nodes.back()[0] = reinterpret_cast<std::uintptr_t>(node);
+        nodes.push_back(node);
+    }
+    stk[0] = reinterpret_cast<std::uintptr_t>(nodes.front());
+    gc_objalloc(&gc, 1, GCF_NONE); // garbage
+
+    gc.concurrent = true;
+    ASSERT_FALSE(gc_collect_step(&gc)); // starts the background marker
+    ASSERT_TRUE(gc.marker != nullptr);
+
+    std::uintptr_t *head {nodes.front()};
+    std::uintptr_t *tail {nodes.back()};
+    gc_store_ref(&gc, head, reinterpret_cast<void **>(head+1), tail); // the marker might scan head concurrently
+    gc_store_ref(&gc, nodes[n-2], reinterpret_cast<void **>(nodes[n-2]), nullptr);
+    void *fresh {gc_objalloc(&gc, 1, GCF_NONE)}; // allocated black
+
+    while (!gc_collect_step(&gc));
+    ASSERT_EQ(gc.phase, GC_PHASE_IDLE);
+    ASSERT_EQ(free_count, 1);
+    ASSERT_EQ(gc_get_size(&gc, tail), 2);
+    ASSERT_EQ(gc_get_size(&gc, fresh), 1);
+
+    stk.fill(0);
+    while (!gc_collect_step(&gc));
+    ASSERT_EQ(free_count, 1+n+1);
+    gc_free(&gc);
+    ASSERT_TRUE(gc.marker == nullptr);
+}
+
+TEST(gc, parallel_marking) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+    gc_pause(&gc);
+
+    constexpr std::size_t n {50000}; // 4-ary tree, every 64th node is a large object
+    std::vector<std::uintptr_t *> nodes {};
+    for (std::size_t i {}; i < n; ++i) {
+        auto *node {static_cast<std::uintptr_t *>(gc_objalloc(&gc, i % 64 == 0 ? 64 : 4, GCF_NONE))};
+        if (i) nodes[(i-1)/4][(i-1)%4] = reinterpret_cast<std::uintptr_t>(node);
+        nodes.push_back(node);
+        gc_objalloc(&gc, i % 2 ? 2 : 40, GCF_NONE); // garbage
+    }
+    stk[0] = reinterpret_cast<std::uintptr_t>(nodes.front());
+
+    gc.mark_threads = 4;
+    gc_collect(&gc);
+    ASSERT_TRUE(gc.mark_pool != nullptr);
+    ASSERT_EQ(free_count, n);
+    ASSERT_EQ(gc.alloc_len, n);
+    for (auto *node : nodes) {
+        ASSERT_NE(gc_get_size(&gc, node), 0);
+    }
+
+    gc_collect(&gc); // reuses the worker pool
+    ASSERT_EQ(free_count, n);
+    stk.fill(0);
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 2*n);
+    gc_free(&gc);
+    ASSERT_TRUE(gc.mark_pool == nullptr);
+}
+
+TEST(gc, nursery_recycles_sparse_blocks) {
+    std::array<std::uintptr_t, 64> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc_pause(&gc);
+    std::vector<void *> objs {};
+    for (int i {}; i < 4096; ++i) { // fills several blocks
+        objs.push_back(gc_objalloc(&gc, 4, GCF_NONE));
+    }
+    for (std::size_t i {}; i < stk.size(); ++i) { // keep a few objects alive, spread over all blocks
+        stk[i] = reinterpret_cast<std::uintptr_t>(objs[i*objs.size()/stk.size()]);
+    }
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, stk.size());
+    ASSERT_TRUE(gc.nursery_recycle != nullptr);
+    const std::size_t blocks {gc.nursery_block_len};
+    ASSERT_GT(blocks, 1);
+
+    for (int i {}; i < 2048; ++i) { // reuses the holes instead of new blocks
+        auto *p {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 4, GCF_NONE))};
+        ASSERT_EQ(p[0]|p[1]|p[2]|p[3], 0); // holes are zeroed
+        p[0] = ~0ull;
+        for (auto live : stk) { // survivors are never overwritten
+            ASSERT_FALSE(reinterpret_cast<std::uintptr_t>(p) < live+32 && live < reinterpret_cast<std::uintptr_t>(p)+32);
+        }
+    }
+    ASSERT_EQ(gc.nursery_block_len, blocks);
+    for (auto live : stk) {
+        ASSERT_EQ(gc_get_size(&gc, reinterpret_cast<void *>(live)), 4);
+    }
+    gc_free(&gc);
+}
+
+TEST(gc, deep_list_uses_mark_stack) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc_pause(&gc);
+    constexpr std::size_t n {200000}; // would exhaust the native stack with recursive marking
+    std::uintptr_t *prev {};
+    for (std::size_t i {}; i < n; ++i) {
+        auto *node {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 1, GCF_NONE))};
+        if (prev) *prev = reinterpret_cast<std::uintptr_t>(node);
+        else stk[0] = reinterpret_cast<std::uintptr_t>(node);
+        prev = node;
+    }
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, n);
+    stk.fill(0);
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, 0);
+    gc_free(&gc);
+}
+
+TEST(gc, mark_stack_overflow_rescans) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc_pause(&gc);
+    constexpr std::size_t n {20000}; // 4-ary tree
+    std::vector<std::uintptr_t *> nodes {};
+    for (std::size_t i {}; i < n; ++i) {
+        auto *node {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 4, GCF_NONE))};
+        if (i) nodes[(i-1)/4][(i-1)%4] = reinterpret_cast<std::uintptr_t>(node);
+        nodes.push_back(node);
+        gc_objalloc(&gc, 1, GCF_NONE); // garbage
+    }
+    stk[0] = reinterpret_cast<std::uintptr_t>(nodes.front());
+    gc.mark_stack_max = 2;
+    gc_collect(&gc);
+    ASSERT_FALSE(gc.mark_overflow);
+    ASSERT_LE(gc.grey_cap, 2);
+    ASSERT_EQ(gc.alloc_len, n);
+    for (auto *node : nodes) {
+        ASSERT_EQ(gc_get_size(&gc, node), 4);
+    }
+    gc_free(&gc);
+}
+
+TEST(gc, layout_scans_only_references) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc_pause(&gc);
+    const std::uint64_t record {0b101}; // { ref, int, ref }
+    const std::uint32_t oid {gc_layout_register(&gc, &record, 3)};
+    const std::uint64_t scalars {0};
+    const std::uint32_t leaf_oid {gc_layout_register(&gc, &scalars, 2)};
+    ASSERT_NE(oid, 0);
+    ASSERT_NE(oid, leaf_oid);
+    auto *arr {static_cast<std::uintptr_t *>(gc_objalloc_typed(&gc, 6, GCF_NONE, oid))}; // Array of two records.
+    void *a {gc_objalloc(&gc, 1, GCF_NONE)};
+    void *b {gc_objalloc(&gc, 1, GCF_NONE)};
+    void *c {gc_objalloc(&gc, 1, GCF_NONE)};
+    void *d {gc_objalloc(&gc, 1, GCF_NONE)};
+    arr[0] = reinterpret_cast<std::uintptr_t>(a);
+    arr[1] = reinterpret_cast<std::uintptr_t>(c); // Looks like a pointer, but is an integer.
+    arr[3] = reinterpret_cast<std::uintptr_t>(b); // Second record.
+    auto *scalar {static_cast<std::uintptr_t *>(gc_objalloc_typed(&gc, 2, GCF_NONE, leaf_oid))};
+    scalar[0] = reinterpret_cast<std::uintptr_t>(d);
+    ASSERT_EQ(gc_get_oid(&gc, arr), oid);
+    ASSERT_EQ(gc_get_oid(&gc, a), 0);
+    ASSERT_TRUE(gc_get_flags(&gc, scalar) & GCF_LEAF);
+    stk[0] = reinterpret_cast<std::uintptr_t>(arr);
+    stk[1] = reinterpret_cast<std::uintptr_t>(scalar);
+    gc_collect(&gc);
+    ASSERT_EQ(gc_get_size(&gc, a), 1);
+    ASSERT_EQ(gc_get_size(&gc, b), 1);
+    ASSERT_EQ(gc_get_size(&gc, c), 0);
+    ASSERT_EQ(gc_get_size(&gc, d), 0);
+    ASSERT_EQ(gc_get_oid(&gc, arr), oid); // Survives rehashing.
+    gc.mark_threads = 2;
+    gc_collect(&gc);
+    ASSERT_EQ(gc_get_size(&gc, b), 1);
+    ASSERT_EQ(gc.alloc_len, 4);
+    gc_free(&gc);
+}
+
+TEST(gc, lazy_sweep_releases_on_allocation) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+    gc_pause(&gc);
+    constexpr int n {100};
+    for (int i {}; i < n; ++i) {
+        gc_objalloc(&gc, GC_NURSERY_MAX_GRANULES+1, GCF_NONE); // individually allocated garbage
+    }
+    gc.pause_target_us = 1000000;
+    while (!gc_collect_step(&gc));
+    ASSERT_EQ(gc.alloc_len, 0);
+    ASSERT_EQ(gc.free_len, n); // detached, but not yet released
+    ASSERT_EQ(free_count, 0);
+    const gc_fatptr_t *buf {gc.freelist};
+    gc_objalloc(&gc, 1, GCF_NONE);
+    ASSERT_EQ(free_count, GC_SWEEP_BATCH);
+    gc_objalloc(&gc, 1, GCF_NONE);
+    ASSERT_EQ(free_count, n);
+    ASSERT_EQ(gc.free_len, 0);
+
+    for (int i {}; i < n; ++i) {
+        gc_objalloc(&gc, GC_NURSERY_MAX_GRANULES+1, GCF_NONE);
+    }
+    gc_collect(&gc); // explicit collections release everything
+    ASSERT_EQ(free_count, 2*n+2);
+    ASSERT_EQ(gc.free_len, 0);
+    ASSERT_EQ(gc.freelist, buf); // buffer is reused across cycles
+    gc_free(&gc);
+}
+
+TEST(gc, deferred_finalization) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    static void *resurrect {};
+    static std::uintptr_t *slot {};
+    free_count = 0;
+    slot = stk.data();
+    gc.dtor_hook = +[](void *ptr) -> void {
+        ++free_count;
+        if (ptr == resurrect) *slot = reinterpret_cast<std::uintptr_t>(ptr);
+    };
+    gc.finalize_deferred = true;
+    gc_pause(&gc);
+    auto *a {static_cast<std::uintptr_t *>(gc_objalloc(&gc, 2, GCF_NONE))};
+    void *b {gc_objalloc(&gc, 1, GCF_NONE)};
+    a[0] = reinterpret_cast<std::uintptr_t>(b);
+    resurrect = a;
+
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 0); // dead, but not yet finalized
+    ASSERT_TRUE(gc_get_flags(&gc, a) & GCF_QUEUED);
+    ASSERT_TRUE(gc_get_flags(&gc, b) & GCF_QUEUED);
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, 2); // queued objects are kept
+
+    ASSERT_EQ(gc_finalize(&gc, SIZE_MAX), 2);
+    ASSERT_EQ(free_count, 2);
+    ASSERT_EQ(stk[0], reinterpret_cast<std::uintptr_t>(a)); // a resurrected itself
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, 2); // b is still reachable through a
+    ASSERT_TRUE(gc_get_flags(&gc, a) & GCF_FINALIZED);
+    ASSERT_FALSE(gc_get_flags(&gc, a) & GCF_QUEUED);
+
+    stk.fill(0);
+    gc_collect(&gc);
+    ASSERT_EQ(gc.alloc_len, 0); // finalizers run only once
+    ASSERT_EQ(free_count, 2);
+    ASSERT_EQ(gc_finalize(&gc, SIZE_MAX), 0);
+    gc_free(&gc);
+}
+
+TEST(gc, cycle_stats) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static std::vector<gc_stats_t> events {};
+    events.clear();
+    gc.stats_hook = +[](const gc_stats_t *s) -> void { events.push_back(*s); };
+    gc_pause(&gc);
+    gc_stats_t stats {};
+    ASSERT_FALSE(gc_get_stats(&gc, 0, &stats));
+    void *live {gc_objalloc(&gc, 4, GCF_NONE)};
+    for (int i {}; i < 10; ++i) {
+        gc_objalloc(&gc, 2, GCF_NONE); // garbage
+    }
+    ASSERT_EQ(gc.alloc_bytes, 4*8+10*2*8);
+    stk[0] = reinterpret_cast<std::uintptr_t>(live);
+    gc_collect(&gc);
+    ASSERT_TRUE(gc_get_stats(&gc, 0, &stats));
+    ASSERT_EQ(stats.id, 1);
+    ASSERT_EQ(stats.trigger, GC_TRIGGER_EXPLICIT);
+    ASSERT_FALSE(stats.minor);
+    ASSERT_EQ(stats.pauses, 1);
+    ASSERT_EQ(stats.objects_before, 11);
+    ASSERT_EQ(stats.objects_after, 1);
+    ASSERT_EQ(stats.bytes_before, 4*8+10*2*8);
+    ASSERT_EQ(stats.bytes_after, 4*8);
+    ASSERT_EQ(stats.objects_freed, 10);
+    ASSERT_EQ(stats.bytes_freed, 10*2*8);
+    ASSERT_EQ(stats.probes, 0); // only nursery objects, which are marked without the table
+    ASSERT_GE(stats.pause_us, stats.sweep_us);
+    ASSERT_EQ(events.size(), 1);
+    ASSERT_EQ(events[0].id, stats.id);
+
+    gc_collect_minor(&gc);
+    ASSERT_TRUE(gc_get_stats(&gc, 0, &stats));
+    ASSERT_EQ(stats.id, 2);
+    ASSERT_TRUE(stats.minor);
+    ASSERT_TRUE(gc_get_stats(&gc, 1, &stats));
+    ASSERT_EQ(stats.id, 1);
+    for (int i {}; i < GC_STATS_HISTORY; ++i) {
+        gc_collect(&gc);
+    }
+    ASSERT_EQ(gc.cycles, 2+GC_STATS_HISTORY);
+    ASSERT_TRUE(gc_get_stats(&gc, GC_STATS_HISTORY-1, &stats));
+    ASSERT_EQ(stats.id, 3);
+    ASSERT_FALSE(gc_get_stats(&gc, GC_STATS_HISTORY, &stats)); // overwritten
+    ASSERT_EQ(events.size(), 2+GC_STATS_HISTORY);
+    gc_free(&gc);
+}
+
+TEST(gc, byte_threshold_triggers_collection) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc.threshold = 1000; // object count alone would not trigger
+    ASSERT_EQ(gc.byte_threshold, GC_MIN_HEAP_BYTES);
+    void *big {gc_objalloc(&gc, static_cast<gc_grasize_t>(gc_bytes2granules(GC_MIN_HEAP_BYTES)+1), GCF_NONE)};
+    ASSERT_EQ(gc.cycles, 1);
+    gc_stats_t stats {};
+    ASSERT_TRUE(gc_get_stats(&gc, 0, &stats));
+    ASSERT_EQ(stats.trigger, GC_TRIGGER_BYTES);
+    ASSERT_GT(gc.byte_threshold, GC_MIN_HEAP_BYTES); // the big object is part of the live heap now
+    gc_objfree(&gc, big);
+    gc_free(&gc);
+}
+
+TEST(gc, heap_limit) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc.heap_limit = 1024;
+    ASSERT_NE(gc_objalloc(&gc, 100, GCF_NONE), nullptr); // 800 bytes, garbage
+    void *live {gc_objalloc(&gc, 100, GCF_NONE)}; // forces a collection, which frees the first one
+    ASSERT_NE(live, nullptr);
+    gc_stats_t stats {};
+    ASSERT_TRUE(gc_get_stats(&gc, 0, &stats));
+    ASSERT_EQ(stats.trigger, GC_TRIGGER_LIMIT);
+    ASSERT_EQ(gc.alloc_bytes, 800);
+    stk[0] = reinterpret_cast<std::uintptr_t>(live);
+    ASSERT_EQ(gc_objalloc(&gc, 100, GCF_NONE), nullptr); // live heap is too large
+    ASSERT_NE(gc_objalloc(&gc, 16, GCF_NONE), nullptr);
+    ASSERT_LE(gc.alloc_bytes, gc.heap_limit);
+    gc_free(&gc);
+}
+
+TEST(gc, controller_adapts_growth_factor) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc_pause(&gc);
+    std::vector<void *> live {};
+    for (int i {}; i < 20000; ++i) {
+        live.push_back(gc_objalloc(&gc, 2, GCF_ROOT)); // expensive to mark
+    }
+    const auto run {[&] {
+        for (int i {}; i < 4; ++i) {
+            for (int j {}; j < 2000; ++j) gc_objalloc(&gc, 1, GCF_NONE);
+            gc_collect(&gc);
+        }
+    }};
+    gc.cpu_target = 1e-9; // GC is always too expensive -> heap grows faster
+    run();
+    ASSERT_GT(gc.sweepfactor, GC_SWEEPFACTOR);
+    ASSERT_LE(gc.sweepfactor, GC_SWEEPFACTOR_MAX);
+    ASSERT_GT(gc.cpu_fraction, 0.0);
+    gc.cpu_target = 1.0; // GC is always cheap -> heap grows slower
+    const double grown {gc.sweepfactor};
+    run();
+    ASSERT_LT(gc.sweepfactor, grown);
+    ASSERT_GE(gc.sweepfactor, GC_SWEEPFACTOR_MIN);
+    for (void *p : live) gc_objfree(&gc, p);
+    gc_free(&gc);
+}
+
+TEST(gc, large_object_space) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    static int free_count {};
+    free_count = 0;
+    gc.dtor_hook = +[](void *) -> void { ++free_count; };
+    gc_pause(&gc);
+    constexpr auto size {static_cast<gc_grasize_t>(gc_bytes2granules(GC_LARGE_MIN_BYTES))};
+    auto *a {static_cast<std::uint8_t *>(gc_objalloc(&gc, size, GCF_NONE))};
+    auto *b {static_cast<std::uintptr_t *>(gc_objalloc(&gc, size, GCF_NONE))};
+    void *c {gc_objalloc(&gc, size+1, GCF_NONE)};
+    void *small {gc_objalloc(&gc, 1, GCF_NONE)};
+    ASSERT_EQ(gc.large_len, 3);
+    for (void *p : {static_cast<void *>(a), static_cast<void *>(b), c}) {
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(p) & (gc.page_size-1), 0);
+        ASSERT_GE(gc_resolve_ptr(&gc, p)->span*gc.page_size, GC_LARGE_MIN_BYTES);
+    }
+    ASSERT_EQ(gc_get_size(&gc, c), size+1);
+    ASSERT_EQ(gc_resolve_ptr(&gc, small)->span, 0);
+    std::memset(a, 0xab, GC_LARGE_MIN_BYTES);
+    b[0] = reinterpret_cast<std::uintptr_t>(c);
+    b[size-1] = reinterpret_cast<std::uintptr_t>(small);
+    stk[0] = reinterpret_cast<std::uintptr_t>(b);
+
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 1); // a
+    ASSERT_EQ(gc.large_len, 2);
+    ASSERT_EQ(gc.large_spare_len, 1);
+    ASSERT_EQ(gc_get_size(&gc, small), 1);
+    auto *reused {static_cast<std::uint8_t *>(gc_objalloc(&gc, size, GCF_NONE))};
+    ASSERT_EQ(reused, a); // cached span
+    ASSERT_EQ(gc.large_spare_len, 0);
+    for (std::size_t i {}; i < GC_LARGE_MIN_BYTES; i += 512) {
+        ASSERT_EQ(reused[i], 0);
+    }
+
+    gc.mark_threads = 2;
+    gc_collect(&gc);
+    ASSERT_EQ(free_count, 2); // reused
+    ASSERT_EQ(gc_get_size(&gc, c), size+1);
+    ASSERT_EQ(gc_get_size(&gc, small), 1);
+
+    stk.fill(0);
+    gc_collect(&gc);
+    ASSERT_EQ(gc.large_len, 0);
+    ASSERT_EQ(gc.alloc_len, 0);
+    ASSERT_EQ(free_count, 5);
+    gc_free(&gc);
+}
+
+TEST(gc, private_heap_teardown) {
+    std::array<std::uintptr_t, 8> stk {};
+    static std::size_t free_count;
+    free_count = 0;
+    for (bool hook : {false, true}) {
+        gc_context_t gc;
+        gc_init(&gc, stk.data(), stk.size());
+#ifndef NEO_USE_SYSTEM_ALLOCATOR
+        ASSERT_NE(gc.heap, nullptr);
+#endif
+        if (hook) {
+            gc.dtor_hook = +[](void *) -> void { ++free_count; };
+        }
+        for (std::size_t i {}; i < 512; ++i) {
+            auto *p {static_cast<std::uintptr_t *>(gc_objalloc(&gc, GC_NURSERY_MAX_GRANULES+1+i%64, GCF_NONE))};
+            p[0] = stk[i % stk.size()];
+            stk[i % stk.size()] = reinterpret_cast<std::uintptr_t>(p);
+        }
+        gc_objalloc(&gc, gc_bytes2granules(GC_LARGE_MIN_BYTES), GCF_NONE);
+        stk.fill(0);
+        gc_free(&gc); // Without a hook, objects are released with the heap.
+        ASSERT_EQ(gc.heap, nullptr);
+        ASSERT_EQ(gc.alloc_len, 0);
+        ASSERT_EQ(free_count, hook ? 512+1 : 0);
+    }
+}
+
+TEST(gc, allocation_profiler) {
+    std::array<std::uintptr_t, 8> stk {};
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    gc.prof_interval = 1024;
+    gc.prof_rng = 42;
+    constexpr std::size_t n {2000};
+    gc.prof_site = 0x30;
+    auto *keep {static_cast<std::uintptr_t *>(gc_objalloc(&gc, n, GCF_ROOT))};
+    for (std::size_t i {}; i < n; ++i) {
+        gc.prof_site = 0x10;
+        keep[i] = reinterpret_cast<std::uintptr_t>(gc_objalloc(&gc, 8, GCF_NONE));
+        gc.prof_site = 0x20;
+        gc_objalloc(&gc, 8, GCF_NONE);
+    }
+    gc_collect(&gc);
+
+    std::array<gc_prof_site_t, 8> sites {};
+    ASSERT_EQ(gc_prof_get_sites(&gc, sites.data(), sites.size()), 3);
+    for (const gc_prof_site_t &site : sites) {
+        if (site.site == 0x30) {
+            ASSERT_EQ(site.samples, 1);
+            ASSERT_EQ(site.live_bytes, site.bytes);
+        } else if (site.site == 0x10 || site.site == 0x20) {
+            ASSERT_GT(site.samples, 0);
+            ASSERT_GT(site.bytes, n*64/2); // Unbiased estimate of 128000 bytes.
+            ASSERT_LT(site.bytes, n*64*2);
+            ASSERT_GT(site.objects, n/2);
+            ASSERT_LT(site.objects, n*2);
+            ASSERT_EQ(site.live_bytes, site.site == 0x10 ? site.bytes : 0); // Only site 0x10 is reachable.
+        }
+    }
+
+    gc.prof_symbolize = +[](std::uintptr_t site) -> const char * { return site == 0x10 ? "main" : nullptr; };
+    std::FILE *f {std::tmpfile()};
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(gc_prof_dump(&gc, f, true), 2);
+    std::rewind(f);
+    std::array<char, 256> buf {};
+    std::string dump {};
+    while (std::fgets(buf.data(), static_cast<int>(buf.size()), f)) { dump += buf.data(); }
+    std::fclose(f);
+    ASSERT_NE(dump.find("main;pc_0x10 "), std::string::npos);
+    ASSERT_EQ(dump.find("pc_0x30 "), 0); // Sites are written in order of their first sample.
+    ASSERT_EQ(dump.find("pc_0x20"), std::string::npos);
+
+    gc_set_flags(&gc, keep, GCF_NONE);
+    gc_collect(&gc);
+    ASSERT_EQ(gc.prof_objs_len, 0);
+    gc_prof_reset(&gc);
+    ASSERT_EQ(gc_prof_get_sites(&gc, nullptr, 0), 0);
+    gc_free(&gc);
+}
+
+static bool thp_available() {
+    bool thp {};
+    if (FILE *f {std::fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r")}) { // e.g. "always [madvise] never"
+        char mode[128] {};
+        thp = std::fgets(mode, sizeof(mode), f) && !std::strstr(mode, "[never]");
+        std::fclose(f);
+    }
+    return thp;
+}
+
+// Is the mapping which contains p advised for huge pages? madvise(MADV_HUGEPAGE) shows up as "hg" in the VmFlags of /proc/self/smaps.
+static bool huge_pages_advised(const void *p) {
+    FILE *f {std::fopen("/proc/self/smaps", "r")};
+    if (!f) return false;
+    const auto addr {reinterpret_cast<unsigned long long>(p)};
+    char line[512] {};
+    bool inside {}, advised {};
+    while (std::fgets(line, sizeof(line), f)) {
+        unsigned long long beg {}, end {};
+        if (std::sscanf(line, "%llx-%llx ", &beg, &end) == 2) {
+            inside = addr >= beg && addr < end;
+        } else if (inside && !std::strncmp(line, "VmFlags:", 8)) {
+            advised = std::strstr(line, " hg") != nullptr;
+            break;
+        }
+    }
+    std::fclose(f);
+    return advised;
+}
+
+TEST(gc, memory_policy) {
+    neo_osi_init();
+    if (!thp_available()) {
+        GTEST_SKIP() << "Transparent huge pages are not available";
+    }
+    const std::size_t size {gc_bytes2granules(2*neo_osi->huge_page_size)};
+    std::array<std::uintptr_t, 8> stk {};
+    neo_mempolicy_set_default(NEO_MEMPOLICY_HUGE_PAGES);
+    gc_context_t gc;
+    gc_init(&gc, stk.data(), stk.size());
+    neo_mempolicy_set_default(NEO_MEMPOLICY_DEFAULT);
+    ASSERT_EQ(gc.mempolicy, NEO_MEMPOLICY_HUGE_PAGES);
+    auto *big {static_cast<std::uintptr_t *>(gc_objalloc(&gc, size, GCF_NONE))};
+    ASSERT_TRUE(huge_pages_advised(big)); // the span of the large object is advised before its first touch
+    stk[0] = reinterpret_cast<std::uintptr_t>(big);
+    gc_collect(&gc);
+    ASSERT_EQ(gc_get_size(&gc, big), size);
+
+    std::array<std::uintptr_t, 8> stk2 {};
+    gc_context_t plain;
+    gc_init(&plain, stk2.data(), stk2.size()); // default policy
+    void *other {gc_objalloc(&plain, size, GCF_NONE)};
+    ASSERT_FALSE(huge_pages_advised(other));
+    gc_free(&plain);
+    gc_free(&gc);
+}
@@ -57,6 +57,20 @@ TEST(prng, diff_float) { // This test just checks that all randoms are different
     }
 }
 
+TEST(vm, stk_alloc_mempolicy) {
+    neo_osi_init();
+    const std::size_t hps {neo_osi->huge_page_size};
+    neo_mempolicy_set_default(NEO_MEMPOLICY_HUGE_PAGES); // VM stacks are mapped directly, so the advice covers whole pages of their own.
+    opstck_t stk {};
+    stk_alloc(&stk, 2*hps, 0);
+    neo_mempolicy_set_default(NEO_MEMPOLICY_DEFAULT);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(stk.p)%neo_osi->page_size, 0);
+    ASSERT_EQ(stk.len, 2*hps/sizeof(record_t));
+    stk.p[stk.len-1].as_int = 1;
+    stk_free(&stk, false);
+    ASSERT_EQ(stk.p, nullptr);
+}
+
 #if 0
 TEST(vm_exec, iror) {
     std::array<record_t, 8> stack {};
@@ -1146,4 +1160,130 @@ TEST(constant_pool, put_has_get) {
 
     constpool_free(&cp);
 }
-#endif
\ No newline at end of file
+#endif
+
+static vm_interrupt_t exec_int_binop(neo_int_t x, neo_int_t y, opcode_t opc, neo_int_t *r, ptrdiff_t *sp_delta) {
+    vm_isolate_t *vm {};
+    vm_init(&vm, "test");
+    bytecode_t bc {};
+    bc_init(&bc);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_NOP));
+    bc_emit_ipush(&bc, x);
+    bc_emit_ipush(&bc, y);
+    bc_emit(&bc, bci_comp_mod1_no_imm(opc));
+    bc_finalize(&bc);
+    EXPECT_TRUE(bc_validate(&bc, vm));
+    bool ok {vm_exec(vm, &bc)};
+    vm_interrupt_t vif {vm->rstate.interrupt};
+    EXPECT_EQ(ok, vif == VMINT_OK);
+    *r = vm->rstate.sp->as_int;
+    *sp_delta = vm->rstate.sp_delta;
+    bc_free(&bc);
+    vm_free(&vm);
+    return vif;
+}
+
+TEST(vm_exec, idiv_fast_path) {
+    neo_int_t r {};
+    ptrdiff_t d {};
+    ASSERT_EQ(exec_int_binop(7, 2, OPC_IDIV, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 3);
+    ASSERT_EQ(d, 1);
+    ASSERT_EQ(exec_int_binop(-7, 2, OPC_IDIV, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, -3);
+    ASSERT_EQ(exec_int_binop(7, -2, OPC_IMOD, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 1);
+    ASSERT_EQ(d, 1);
+}
+
+TEST(vm_exec, idiv_minus_one) {
+    neo_int_t r {};
+    ptrdiff_t d {};
+    ASSERT_EQ(exec_int_binop(7, -1, OPC_IDIV, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, -7);
+    ASSERT_EQ(d, 1);
+    ASSERT_EQ(exec_int_binop(NEO_INT_MIN, -1, OPC_IDIV, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, NEO_INT_MIN);
+    ASSERT_EQ(d, 1);
+    ASSERT_EQ(exec_int_binop(7, -1, OPC_IMOD, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(exec_int_binop(NEO_INT_MIN, -1, OPC_IMOD, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(d, 1);
+}
+
+TEST(vm_exec, idiv_imod_zero_division) {
+    neo_int_t r {};
+    ptrdiff_t d {};
+    ASSERT_EQ(exec_int_binop(7, 0, OPC_IDIV, &r, &d), VMINT_ARI_ZERODIV);
+    ASSERT_EQ(d, 2);
+    ASSERT_EQ(exec_int_binop(NEO_INT_MIN, 0, OPC_IMOD, &r, &d), VMINT_ARI_ZERODIV);
+    ASSERT_EQ(d, 2);
+}
+
+TEST(vm_exec, rotations_pop_operand) {
+    neo_int_t r {};
+    ptrdiff_t d {};
+    ASSERT_EQ(exec_int_binop(1, 1, OPC_IROL, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 2);
+    ASSERT_EQ(d, 1);
+    ASSERT_EQ(exec_int_binop(2, 1, OPC_IROR, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 1);
+    ASSERT_EQ(d, 1);
+}
+
+TEST(vm_exec, pop_and_syscall_depths) {
+    vm_isolate_t *vm {};
+    vm_init(&vm, "test");
+    bytecode_t bc {};
+    bc_init(&bc);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_NOP));
+    bc_emit_ipush(&bc, 3);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_POP)); /* Popping the last record is fine. */
+    bc_emit_ipush(&bc, 7);
+    bc_emit(&bc, bci_comp_mod1_umm24(OPC_SYSCALL, SYSCALL_PRINT_INT)); /* Consumes its operand. */
+    bc_finalize(&bc);
+    ASSERT_TRUE(bc_validate(&bc, vm));
+    ASSERT_TRUE(vm_exec(vm, &bc));
+    ASSERT_EQ(vm->rstate.interrupt, VMINT_OK);
+    ASSERT_EQ(vm->rstate.sp_delta, 0);
+    bc_free(&bc);
+    bc_init(&bc);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_NOP));
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_POP)); /* Pop from the empty stack. */
+    bc_finalize(&bc);
+    ASSERT_FALSE(vm_exec(vm, &bc));
+    ASSERT_EQ(vm->rstate.interrupt, VMINT_STK_UNDERFLOW);
+    ASSERT_EQ(vm->rstate.sp_delta, 0);
+    bc_free(&bc);
+    vm_free(&vm);
+}
+
+TEST(vm_exec, publishes_stack_top_to_gc) {
+    vm_isolate_t *vm {};
+    vm_init(&vm, "test");
+    ASSERT_EQ(vm->gc_context.stk_top, vm->stack.p);
+    bytecode_t bc {};
+    bc_init(&bc);
+    bc_emit(&bc, bci_comp_mod1_no_imm(OPC_NOP));
+    bc_emit_ipush(&bc, 1);
+    bc_emit_ipush(&bc, 2);
+    bc_finalize(&bc);
+    ASSERT_TRUE(vm_exec(vm, &bc));
+    ASSERT_EQ(vm->gc_context.stk_top, vm->rstate.sp);
+    ASSERT_EQ(vm->gc_context.stk_top, vm->stack.p+2);
+    bc_free(&bc);
+    vm_free(&vm);
+}
+
+TEST(vm_exec, islr_masks_shift_amount) {
+    neo_int_t r {};
+    ptrdiff_t d {};
+    ASSERT_EQ(exec_int_binop(-1, 65, OPC_ISLR, &r, &d), VMINT_OK); /* Same as a shift by 1. */
+    ASSERT_EQ(r, NEO_INT_MAX);
+    ASSERT_EQ(d, 1);
+    ASSERT_EQ(exec_int_binop(-1, 64, OPC_ISLR, &r, &d), VMINT_OK); /* Same as a shift by 0. */
+    ASSERT_EQ(r, -1);
+    ASSERT_EQ(exec_int_binop(-1, 127, OPC_ISLR, &r, &d), VMINT_OK);
+    ASSERT_EQ(r, 1);
+}